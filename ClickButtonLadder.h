@@ -0,0 +1,141 @@
+// ----------------------------------------------------------------------------
+// Resistor ladder of buttons on a single analog pin
+// Supports Click, DoubleClick, Long Click for every button
+//
+// Every button has its own state machine, which follows the same rules as
+// the button of ClickEncoder.
+// ----------------------------------------------------------------------------
+
+#ifndef __have__ClickButtonLadder_h__
+#define __have__ClickButtonLadder_h__
+
+#include <ClickEncoder.h>
+
+// ----------------------------------------------------------------------------
+// Button configuration (values for 1ms timer service calls), same defaults as ClickEncoder
+//
+#define DEFAULT_ENC_BUTTONINTERVAL 32 // check buttonState every x milliseconds, also debouce time
+#define BTN_DOUBLECLICKTIME 512       // second click within 512ms
+#define BTN_HOLDTIME 1024             // report held button after ~1s
+
+// ----------------------------------------------------------------------------
+// ADC values of one button (inclusive)
+template <int16_t low, int16_t high>
+struct AnalogRange {
+    static_assert(low <= high, "The lower bound of an AnalogRange must not exceed its upper bound!");
+
+    static const int16_t rangeLow = low;
+    static const int16_t rangeHigh = high;
+};
+
+// List of the ranges of all buttons, the order defines the button index
+template <typename... Ranges>
+struct AnalogRanges;
+
+template <>
+struct AnalogRanges<> {
+    static const uint8_t count = 0;
+
+    static inline __attribute__((always_inline)) uint8_t find(int16_t /*value*/, uint8_t button) {
+        return button;
+    }
+};
+
+template <typename Range, typename... Rest>
+struct AnalogRanges<Range, Rest...> {
+    typedef AnalogRanges<Rest...> Next;
+
+    static const uint8_t count = 1 + Next::count;
+
+    // Index of the button whose range contains value, count if there is none
+    static inline __attribute__((always_inline)) uint8_t find(int16_t value, uint8_t button) {
+        return (value >= Range::rangeLow && value <= Range::rangeHigh) ? button : Next::find(value, button + 1);
+    }
+};
+
+// ----------------------------------------------------------------------------
+// The ADC conversion is requested one service tick before the button check, which collects it,
+// so service() never waits for the ADC, also if other analog buttons share it.
+template <int8_t pinBTN,
+          typename Ranges,
+          uint8_t ENC_BUTTONINTERVAL = DEFAULT_ENC_BUTTONINTERVAL,
+          uint16_t buttonHoldTime = BTN_HOLDTIME,
+          uint16_t buttonDoubleClickTime = BTN_DOUBLECLICKTIME>
+class ClickButtonLadder {
+  public:
+    static const uint8_t buttonCount = Ranges::count;
+
+    static_assert(Ranges::count > 0, "A ClickButtonLadder needs at least one button!");
+    static_assert(Ranges::count < 0xFF, "Too many buttons!");
+
+    static void init();
+
+    static inline void service() __attribute__((always_inline));
+
+    static ButtonState getButtonState(uint8_t button);
+
+    static inline void setDoubleClickEnabled(bool d) {
+        doubleClickEnabled = d;
+    }
+
+    static inline bool getDoubleClickEnabled() __attribute__((always_inline)) {
+        return doubleClickEnabled;
+    }
+
+    static inline void setButtonHeldEnabled(bool d) {
+        buttonHeldEnabled = d;
+    }
+
+    static inline bool getButtonHeldEnabled() __attribute__((always_inline)) {
+        return buttonHeldEnabled;
+    }
+
+  private:
+    static inline void serviceButtonTick(uint8_t button, bool keyDown) __attribute__((always_inline));
+
+  protected:
+    static bool doubleClickEnabled;
+    static bool buttonHeldEnabled;
+    static unsigned long lastButtonCheck;
+
+    static uint16_t keyDownTicks[Ranges::count];
+    static uint16_t doubleClickTicks[Ranges::count];
+    static volatile ButtonState buttonState[Ranges::count];
+};
+
+#define LADDER_TEMPLATE_TYPES template <int8_t pinBTN,                  \
+                                        typename Ranges,                \
+                                        uint8_t ENC_BUTTONINTERVAL,     \
+                                        uint16_t buttonHoldTime,        \
+                                        uint16_t buttonDoubleClickTime>
+
+#define LADDER_TEMPLATE_TYPE_NAMES pinBTN,             \
+                                   Ranges,             \
+                                   ENC_BUTTONINTERVAL, \
+                                   buttonHoldTime,     \
+                                   buttonDoubleClickTime
+
+LADDER_TEMPLATE_TYPES
+bool ClickButtonLadder<LADDER_TEMPLATE_TYPE_NAMES>::doubleClickEnabled = true;
+LADDER_TEMPLATE_TYPES
+bool ClickButtonLadder<LADDER_TEMPLATE_TYPE_NAMES>::buttonHeldEnabled = true;
+LADDER_TEMPLATE_TYPES
+unsigned long ClickButtonLadder<LADDER_TEMPLATE_TYPE_NAMES>::lastButtonCheck = 0;
+LADDER_TEMPLATE_TYPES
+uint16_t ClickButtonLadder<LADDER_TEMPLATE_TYPE_NAMES>::keyDownTicks[Ranges::count] = {0};
+LADDER_TEMPLATE_TYPES
+uint16_t ClickButtonLadder<LADDER_TEMPLATE_TYPE_NAMES>::doubleClickTicks[Ranges::count] = {0};
+LADDER_TEMPLATE_TYPES
+volatile ButtonState ClickButtonLadder<LADDER_TEMPLATE_TYPE_NAMES>::buttonState[Ranges::count] = {Open};
+
+// ----------------------------------------------------------------------------
+
+#include "ClickButtonLadder.tpp"
+
+#undef DEFAULT_ENC_BUTTONINTERVAL
+#undef BTN_DOUBLECLICKTIME
+#undef BTN_HOLDTIME
+#undef LADDER_TEMPLATE_TYPES
+#undef LADDER_TEMPLATE_TYPE_NAMES
+
+#endif // __have__ClickButtonLadder_h__
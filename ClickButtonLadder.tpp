@@ -0,0 +1,64 @@
+// ----------------------------------------------------------------------------
+// Resistor ladder of buttons on a single analog pin
+// Supports Click, DoubleClick, Long Click for every button
+//
+// Every button has its own state machine, which follows the same rules as
+// the button of ClickEncoder.
+// ----------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+LADDER_TEMPLATE_TYPES
+void ClickButtonLadder<LADDER_TEMPLATE_TYPE_NAMES>::init() {
+    FastPin<pinBTN>::setInput();
+
+    // The first button check collects the conversion started here
+    AsyncAnalogRead<pinBTN, ClickButtonLadder>::init();
+}
+
+// ----------------------------------------------------------------------------
+LADDER_TEMPLATE_TYPES
+void ClickButtonLadder<LADDER_TEMPLATE_TYPE_NAMES>::service() {
+    unsigned long currentMillis = millis();
+
+    // Handle case when millis() wraps back around to zero
+    unsigned long elapsed = currentMillis - lastButtonCheck;
+    if (elapsed >= ENC_BUTTONINTERVAL) {
+        lastButtonCheck = currentMillis;
+
+        // Collect the conversion requested one tick before
+        int16_t value = AsyncAnalogRead<pinBTN, ClickButtonLadder>::check();
+
+        uint8_t pressed = Ranges::find(value, 0);
+
+        for (uint8_t button = 0; button < Ranges::count; ++button) {
+            // A released button without pending ticks does not change its state
+            if (button == pressed || keyDownTicks[button] || doubleClickTicks[button]) {
+                serviceButtonTick(button, button == pressed);
+            }
+        }
+    } else if (elapsed == ENC_BUTTONINTERVAL - 1) {
+        AsyncAnalogRead<pinBTN, ClickButtonLadder>::start();
+    } else {
+        AsyncAnalogRead<pinBTN, ClickButtonLadder>::poll();
+    }
+}
+
+// One button check, same logic as ClickEncoder::serviceButtonTick()
+LADDER_TEMPLATE_TYPES
+void ClickButtonLadder<LADDER_TEMPLATE_TYPE_NAMES>::serviceButtonTick(uint8_t button, bool keyDown) {
+    ButtonStateMachine<ENC_BUTTONINTERVAL, buttonHoldTime, buttonDoubleClickTime>::tick(
+        keyDown, keyDownTicks[button], doubleClickTicks[button], buttonState[button], buttonHeldEnabled, doubleClickEnabled,
+        [button](ButtonState state) { buttonState[button] = state; });
+}
+
+// ----------------------------------------------------------------------------
+LADDER_TEMPLATE_TYPES
+ButtonState ClickButtonLadder<LADDER_TEMPLATE_TYPE_NAMES>::getButtonState(uint8_t button) {
+    ButtonState ret = buttonState[button];
+    if (ret != Held) {
+        // Reads & writes of one byte values is fine when interrupts are enabled (needs only one cycle)
+        buttonState[button] = Open; // reset
+    }
+
+    return ret;
+}
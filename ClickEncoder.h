@@ -32,6 +32,8 @@
 #endif
 #include <Arduino.h>
 
+#include "ClickEncoderNotches.h"
+
 // ----------------------------------------------------------------------------
 
 #define ENC_NORMAL (1 << 1) // use Peter Danneger's decoder
@@ -53,9 +55,44 @@
 #endif
 #endif
 
-#if defined(ROTARY_ISR_SERVICE) && defined(SPLIT_ROTARY_ISR_SERVICE) && ENC_DECODER != ENC_NORMAL
-#error "Splitting the rotary ISR service code is currently only supported for normal encoder!"
+#if defined(ROTARY_ACCEL_OPTIMIZATION) && defined(ROTARY_ACCEL_TIMESTAMPS)
+#error "ROTARY_ACCEL_OPTIMIZATION and ROTARY_ACCEL_TIMESTAMPS can not be combined!"
+#endif
+
+#if defined(ENC_COMPACT_STATE) && (ENC_COMPACT_STATE < 1 || ENC_COMPACT_STATE > 255)
+#error "ENC_COMPACT_STATE has to be the byte budget per encoder (1 - 255)!"
+#endif
+
+#if defined(BUTTON_ISR_SERVICE) && defined(WITHOUT_BUTTON)
+#error "BUTTON_ISR_SERVICE requires a button!"
+#endif
+
+// ----------------------------------------------------------------------------
+// Disables interrupts for its lifetime and restores the previous state afterwards,
+// so it can also be used from interrupt service routines & other critical sections
+struct EncoderInterruptLock {
+#if defined(__AVR__)
+    uint8_t sreg;
+
+    inline EncoderInterruptLock() __attribute__((always_inline)) : sreg(SREG) {
+        cli();
+    }
+
+    inline ~EncoderInterruptLock() __attribute__((always_inline)) {
+        __asm__ __volatile__("" ::: "memory");
+        SREG = sreg;
+    }
+#else
+    // Other platforms have no portable way to read the interrupt state
+    inline EncoderInterruptLock() __attribute__((always_inline)) {
+        noInterrupts();
+    }
+
+    inline ~EncoderInterruptLock() __attribute__((always_inline)) {
+        interrupts();
+    }
 #endif
+};
 
 // ----------------------------------------------------------------------------
 #if defined(__arm__) && (defined(__STM32F1__) || defined(__STM32F4__))
@@ -64,8 +101,211 @@ typedef WiringPinMode pinMode_t;
 typedef uint8_t pinMode_t;
 #endif
 
+// ----------------------------------------------------------------------------
+// Decoder policies
+//
+// A decoder is a state machine driven by a single table lookup on (previous state, current pin levels),
+// which yields the new state and the detected step incl. its direction. The tables are generated at
+// compile time and stored in program memory, one per decoder type (shared by all encoders using it).
+//
+// transitionsPerStep: quadrature transitions per reported step, 1 = quarter step (every transition),
+//                     2 = half step (two steps per cycle), 4 = full step (one step per cycle)
+// detentPosition:     position of the rest position inside the Gray code cycle 00 -> 01 -> 11 -> 10
+//                     (pin levels A B, 1 = active), steps are reported when a detent is reached
+//
+// Transitions back and forth between two detents (i.e. caused by a bouncing contact) cancel each
+// other out before a step is reported. Illegal transitions (both pins toggled) keep the last state.
+
+template <uint8_t... I>
+struct EncoderTableIndices {};
+
+template <uint8_t N, uint8_t... I>
+struct MakeEncoderTableIndices : MakeEncoderTableIndices<N - 1, N - 1, I...> {};
+
+template <uint8_t... I>
+struct MakeEncoderTableIndices<0, I...> {
+    typedef EncoderTableIndices<I...> type;
+};
+
+template <typename Decoder, typename Indices>
+struct EncoderDecoderTable;
+
+template <typename Decoder, uint8_t... I>
+struct EncoderDecoderTable<Decoder, EncoderTableIndices<I...>> {
+    static const uint8_t entries[sizeof...(I)];
+};
+
+template <typename Decoder, uint8_t... I>
+const uint8_t EncoderDecoderTable<Decoder, EncoderTableIndices<I...>>::entries[sizeof...(I)] __attribute__((__progmem__)) = {Decoder::tableEntry(I)...};
+
+template <uint8_t transitionsPerStep, uint8_t detentPosition = 0>
+struct QuadratureDecoder {
+    static_assert(transitionsPerStep == 1 || transitionsPerStep == 2 || transitionsPerStep == 4, "transitionsPerStep has to be 1, 2 or 4!");
+    static_assert(detentPosition < 4, "detentPosition has to be between 0 and 3!");
+
+    // State = (progress since the last detent + transitionsPerStep - 1) * 4 + position
+    static const uint8_t stateCount = (2 * transitionsPerStep - 1) * 4;
+
+    // Raw samples are decoded directly, so the decoder can be driven by pin change interrupts
+    static const uint8_t filterDepth = 0;
+
+    typedef uint8_t state_t;
+
+    typedef EncoderDecoderTable<QuadratureDecoder, typename MakeEncoderTableIndices<stateCount * 4>::type> Table;
+
+    // Table entry: bit 0-4 = next state, bit 6-7 = signed step (-1, 0, 1)
+    static inline uint8_t next(uint8_t state, uint8_t pinLevels) __attribute__((always_inline)) {
+        return pgm_read_byte(&Table::entries[(state << 2) | pinLevels]);
+    }
+
+    static inline uint8_t state(uint8_t entry) __attribute__((always_inline)) {
+        return entry & 0x1F;
+    }
+
+    static inline int8_t step(uint8_t entry) __attribute__((always_inline)) {
+        return (int8_t)entry >> 6;
+    }
+
+    // Pin levels (A << 1 | B) of the last accepted transition
+    static inline uint8_t pins(uint8_t state) __attribute__((always_inline)) {
+        return grayCode(state & 0x03);
+    }
+
+    static constexpr uint8_t initialState(uint8_t pinLevels) {
+        return encode(position(pinLevels), (position(pinLevels) - detentPosition) & (transitionsPerStep - 1));
+    }
+
+    // ---Compile time table generation-----------------------------------------------
+
+    // Position inside the Gray code cycle and back
+    static constexpr uint8_t position(uint8_t pinLevels) {
+        return pinLevels ^ (pinLevels >> 1);
+    }
+
+    static constexpr uint8_t grayCode(uint8_t pos) {
+        return pos ^ (pos >> 1);
+    }
+
+    static constexpr uint8_t encode(uint8_t pos, int8_t prog) {
+        return (uint8_t)((prog + transitionsPerStep - 1) * 4 + pos);
+    }
+
+    static constexpr int8_t progress(uint8_t state) {
+        return (int8_t)(state / 4) - (transitionsPerStep - 1);
+    }
+
+    // Reaching the next detent reports a step and restarts counting the progress
+    static constexpr uint8_t move(uint8_t pos, int8_t prog) {
+        return prog == transitionsPerStep    ? (uint8_t)(encode(pos, 0) | 0x40)
+               : prog == -transitionsPerStep ? (uint8_t)(encode(pos, 0) | 0xC0)
+                                             : encode(pos, prog);
+    }
+
+    static constexpr uint8_t transition(uint8_t state, uint8_t pos) {
+        return ((pos - (state & 0x03)) & 0x03) == 1   ? move(pos, progress(state) + 1)
+               : ((pos - (state & 0x03)) & 0x03) == 3 ? move(pos, progress(state) - 1)
+                                                      : state;
+    }
+
+    static constexpr uint8_t tableEntry(uint8_t index) {
+        return transition(index >> 2, position(index & 0x03));
+    }
+};
+
+typedef QuadratureDecoder<1> QuarterStepDecoder;
+typedef QuadratureDecoder<2> HalfStepDecoder;
+typedef QuadratureDecoder<4> FullStepDecoder;
+
+// ----------------------------------------------------------------------------
+// Glitch filter of a single pin: a saturating integrator counts up for every active sample and down
+// for every inactive one (between 0 and filterDepth). The filtered level only changes at the bounds,
+// so pulses shorter than filterDepth samples are suppressed and a clean edge is delayed by
+// filterDepth - 1 samples. The state of a pin fits into a nibble, the table takes 32 bytes of flash.
+
+template <uint8_t filterDepth>
+struct GlitchFilter {
+    static_assert(filterDepth >= 2 && filterDepth <= 7, "filterDepth has to be between 2 and 7!");
+
+    typedef EncoderDecoderTable<GlitchFilter, typename MakeEncoderTableIndices<32>::type> Table;
+
+    // State & table entry: bit 0-2 = integrator, bit 3 = filtered level
+    static inline uint8_t next(uint8_t state, uint8_t level) __attribute__((always_inline)) {
+        return pgm_read_byte(&Table::entries[(state << 1) | level]);
+    }
+
+    static inline uint8_t level(uint8_t state) __attribute__((always_inline)) {
+        return state >> 3;
+    }
+
+    static constexpr uint8_t initialState(uint8_t level) {
+        return level ? (0x08 | filterDepth) : 0;
+    }
+
+    // ---Compile time table generation-----------------------------------------------
+
+    static constexpr uint8_t integrate(uint8_t count, uint8_t level) {
+        return level ? (count < filterDepth ? count + 1 : filterDepth) : (count > 0 ? count - 1 : 0);
+    }
+
+    static constexpr uint8_t hysteresis(uint8_t count, uint8_t state) {
+        return count == filterDepth ? (0x08 | count) : count == 0 ? 0 : ((state & 0x08) | count);
+    }
+
+    static constexpr uint8_t tableEntry(uint8_t index) {
+        return hysteresis(integrate((index >> 1) & 0x07, index & 0x01), index >> 1);
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Decoder policy which passes both pins through a GlitchFilter before they reach Decoder.
+// Allows oversampling (i.e. service() at 4-10 kHz) of bouncing encoders without counting the bounces.
+// Needs periodic samples, so it can not be used with ROTARY_ISR_SERVICE.
+//
+// State & table entry: bit 0-7 = state / entry of Decoder, bit 8-11 = filter of pin B, bit 12-15 = filter of pin A
+
+template <typename Decoder, uint8_t depth>
+struct FilteredDecoder {
+    typedef GlitchFilter<depth> Filter;
+
+    static const uint8_t filterDepth = depth;
+
+    typedef uint16_t state_t;
+
+    static inline uint16_t next(uint16_t state, uint8_t pinLevels) __attribute__((always_inline)) {
+        uint8_t filterA = Filter::next(state >> 12, pinLevels >> 1);
+        uint8_t filterB = Filter::next((state >> 8) & 0x0F, pinLevels & 0x01);
+        uint8_t entry = Decoder::next((uint8_t)state, (Filter::level(filterA) << 1) | Filter::level(filterB));
+        return ((uint16_t)((filterA << 4) | filterB) << 8) | entry;
+    }
+
+    static inline uint16_t state(uint16_t entry) __attribute__((always_inline)) {
+        return (entry & 0xFF00) | Decoder::state((uint8_t)entry);
+    }
+
+    static inline int8_t step(uint16_t entry) __attribute__((always_inline)) {
+        return Decoder::step((uint8_t)entry);
+    }
+
+    // Filtered pin levels (A << 1 | B) of the last accepted transition
+    static inline uint8_t pins(uint16_t state) __attribute__((always_inline)) {
+        return Decoder::pins((uint8_t)state);
+    }
+
+    static constexpr uint16_t initialState(uint8_t pinLevels) {
+        return ((uint16_t)((Filter::initialState(pinLevels >> 1) << 4) | Filter::initialState(pinLevels & 0x01)) << 8) | Decoder::initialState(pinLevels);
+    }
+};
+
+// Decoder used if none is passed as template parameter
+#if ENC_DECODER == ENC_FLAKY && ENC_HALFSTEP
+#define DEFAULT_ENC_DECODER HalfStepDecoder
+#else
+#define DEFAULT_ENC_DECODER QuarterStepDecoder
+#endif
+
 // ----------------------------------------------------------------------------
 // Acceleration configuration (for 1000Hz calls to ::service())
+// With ROTARY_ACCEL_TIMESTAMPS ENC_ACCEL_DEC is applied per elapsed millisecond instead of per call
 //
 #define DEFAULT_ENC_ACCEL_TOP 3072 // max. acceleration: 12 encoded as maxAccel * pow(2, 8)
 #define DEFAULT_ENC_ACCEL_INC 25
@@ -87,7 +327,8 @@ typedef uint8_t pinMode_t;
              uint16_t buttonDoubleClickTime = BTN_DOUBLECLICKTIME,    \
              bool analogInput = false,                                \
              int16_t anlogActiveRangeLow = 0,                         \
-             int16_t anlogActiveRangeHigh = 0
+             int16_t anlogActiveRangeHigh = 0,                        \
+             typename Decoder = DEFAULT_ENC_DECODER
 
 #define TEMPLATE_TYPES template <uint8_t pinA,                   \
                                  uint8_t pinB,                   \
@@ -102,7 +343,8 @@ typedef uint8_t pinMode_t;
                                  uint16_t buttonDoubleClickTime, \
                                  bool analogInput,               \
                                  int16_t anlogActiveRangeLow,    \
-                                 int16_t anlogActiveRangeHigh>
+                                 int16_t anlogActiveRangeHigh,   \
+                                 typename Decoder>
 
 #define TEMPLATE_TYPE_NAMES pinA,                  \
                             pinB,                  \
@@ -117,28 +359,32 @@ typedef uint8_t pinMode_t;
                             buttonDoubleClickTime, \
                             analogInput,           \
                             anlogActiveRangeLow,   \
-                            anlogActiveRangeHigh
+                            anlogActiveRangeHigh,  \
+                            Decoder
 #else
 #define TEMPLATE_PARAMETERS uint8_t pinA, uint8_t pinB,                           \
                             bool pinsActive = false,                              \
                                  uint8_t stepsPerNotch = DEFAULT_STEPS_PER_NOTCH, \
                                  uint16_t ENC_ACCEL_TOP = DEFAULT_ENC_ACCEL_TOP,  \
                                  uint16_t ENC_ACCEL_INC = DEFAULT_ENC_ACCEL_INC,  \
-                                 uint16_t ENC_ACCEL_DEC = DEFAULT_ENC_ACCEL_DEC
+                                 uint16_t ENC_ACCEL_DEC = DEFAULT_ENC_ACCEL_DEC,  \
+                                 typename Decoder = DEFAULT_ENC_DECODER
 
 #define TEMPLATE_TYPES template <uint8_t pinA, uint8_t pinB, \
                                  bool pinsActive,            \
                                  uint8_t stepsPerNotch,      \
                                  uint16_t ENC_ACCEL_TOP,     \
                                  uint16_t ENC_ACCEL_INC,     \
-                                 uint16_t ENC_ACCEL_DEC>
+                                 uint16_t ENC_ACCEL_DEC,     \
+                                 typename Decoder>
 
 #define TEMPLATE_TYPE_NAMES pinA, pinB,    \
                             pinsActive,    \
                             stepsPerNotch, \
                             ENC_ACCEL_TOP, \
                             ENC_ACCEL_INC, \
-                            ENC_ACCEL_DEC
+                            ENC_ACCEL_DEC, \
+                            Decoder
 #endif
 #define TEMPLATE_DEFINITION template <TEMPLATE_PARAMETERS>
 
@@ -152,12 +398,194 @@ typedef enum {
     DoubleClicked
 } ButtonState;
 
+// ----------------------------------------------------------------------------
+// One button check, which is done every ENC_BUTTONINTERVAL, shared by ClickEncoder & ClickButtonLadder.
+// The counters are passed by reference, so that every user keeps them in its own storage. state is the
+// current button state, every change is passed to report(state), in the order of occurrence.
+template <uint8_t ENC_BUTTONINTERVAL, uint16_t buttonHoldTime, uint16_t buttonDoubleClickTime, uint16_t keyDownTicksLimit = 0xFFFF>
+struct ButtonStateMachine {
+    template <typename Report>
+    static inline void tick(bool keyDown, uint16_t &keyDownTicks, uint16_t &doubleClickTicks, ButtonState state,
+                            bool heldEnabled, bool doubleClickEnabled, Report report) __attribute__((always_inline));
+};
+
+template <uint8_t ENC_BUTTONINTERVAL, uint16_t buttonHoldTime, uint16_t buttonDoubleClickTime, uint16_t keyDownTicksLimit>
+template <typename Report>
+void ButtonStateMachine<ENC_BUTTONINTERVAL, buttonHoldTime, buttonDoubleClickTime, keyDownTicksLimit>::tick(
+    bool keyDown, uint16_t &keyDownTicks, uint16_t &doubleClickTicks, ButtonState state, bool heldEnabled, bool doubleClickEnabled, Report report) {
+    if (keyDown) {
+        // Saturates instead of wrapping around, the button stays held
+        if (keyDownTicks < keyDownTicksLimit) {
+            ++keyDownTicks;
+        }
+        if (heldEnabled && keyDownTicks > (buttonHoldTime / ENC_BUTTONINTERVAL) && state != Held) {
+            report(Held);
+        }
+    } else {                    // key is now up
+        if (keyDownTicks > 1) { //Make sure key was down through 1 complete tick to prevent random transients from registering as click
+            if (state == Held) {
+                report(Released);
+                doubleClickTicks = 0;
+            } else {
+#define ENC_SINGLECLICKONLY 1
+                if (doubleClickTicks > ENC_SINGLECLICKONLY) { // prevent trigger in single click mode
+                    if (doubleClickTicks < (buttonDoubleClickTime / ENC_BUTTONINTERVAL)) {
+                        report(DoubleClicked);
+                        doubleClickTicks = 0;
+                    }
+                } else {
+                    doubleClickTicks = (doubleClickEnabled) ? (buttonDoubleClickTime / ENC_BUTTONINTERVAL) : ENC_SINGLECLICKONLY;
+                }
+            }
+        }
+
+        keyDownTicks = 0;
+    }
+
+    if (doubleClickTicks > 0) {
+        --doubleClickTicks;
+        if (doubleClickTicks == 0) {
+            report(Clicked);
+        }
+    }
+}
+
+#ifdef ENC_EVENT_QUEUE_SIZE
+#if ENC_EVENT_QUEUE_SIZE < 2 || ENC_EVENT_QUEUE_SIZE > 128 || (ENC_EVENT_QUEUE_SIZE & (ENC_EVENT_QUEUE_SIZE - 1))
+#error "ENC_EVENT_QUEUE_SIZE has to be a power of two between 2 and 128!"
+#endif
+
+// Button events use the same values as the corresponding ButtonState
+typedef enum {
+    EncoderRotated = Open,
+
+    ButtonHeld = Held,
+    ButtonReleased = Released,
+
+    ButtonClicked = Clicked,
+    ButtonDoubleClicked = DoubleClicked
+} EncoderEventType;
+
+typedef struct {
+    uint16_t timestamp; // lower 16 bit of millis() when the event was queued
+    int16_t notches;    // EncoderRotated: signed notches incl. acceleration, 0 for button events
+    uint8_t type;       // EncoderEventType
+} EncoderEvent;
+
+// Lock-free single producer (service routines) single consumer (main loop) ring buffer.
+// head & tail are free running, the size has to be a power of two.
+template <uint8_t size>
+struct EncoderEventQueue {
+    EncoderEvent entries[size];
+    volatile uint8_t head; // only written by the producer
+    volatile uint8_t tail; // only written by the consumer
+
+    inline bool full() const {
+        return (uint8_t)(head - tail) == size;
+    }
+
+    inline bool push(uint8_t type, int16_t notches, uint16_t timestamp) {
+        uint8_t _head = head;
+        if ((uint8_t)(_head - tail) == size) {
+            return false;
+        }
+
+        EncoderEvent &event = entries[_head & (size - 1)];
+        event.timestamp = timestamp;
+        event.notches = notches;
+        event.type = type;
+
+        // The entry has to be written before it gets published
+        __asm__ __volatile__("" ::: "memory");
+        head = _head + 1;
+        return true;
+    }
+
+    inline bool pop(EncoderEvent &event) {
+        uint8_t _tail = tail;
+        if (_tail == head) {
+            return false;
+        }
+
+        // head has to be read before the entry
+        __asm__ __volatile__("" ::: "memory");
+        event = entries[_tail & (size - 1)];
+
+        // The entry has to be read before it gets released
+        __asm__ __volatile__("" ::: "memory");
+        tail = _tail + 1;
+        return true;
+    }
+};
+#endif
+
+#ifdef ENC_STATISTICS
+// Free running counters of the service routines, the difference of two snapshots gives the rates
+struct EncoderStatistics {
+    uint32_t serviceCalls;        // calls of service()
+    uint32_t steps;               // steps reported by the decoder
+    uint16_t jitterRejections;    // servicePinA()/servicePinB() calls without a pin toggle
+    uint16_t illegalTransitions;  // both pins toggled between two samples, the steps got lost
+    uint16_t deltaOverflows;      // more pending steps than the step counter can hold, the steps got lost
+    uint16_t droppedButtonEvents; // button states overwritten before getButtonState(), with the event queue events not fitting into it
+    uint16_t accelerationTopHits; // accelerations limited to ENC_ACCEL_TOP
+
+    inline bool operator==(const EncoderStatistics &other) const {
+        return serviceCalls == other.serviceCalls && steps == other.steps &&
+               jitterRejections == other.jitterRejections && illegalTransitions == other.illegalTransitions &&
+               deltaOverflows == other.deltaOverflows && droppedButtonEvents == other.droppedButtonEvents &&
+               accelerationTopHits == other.accelerationTopHits;
+    }
+};
+#endif
+
+#ifdef ENC_COMPACT_STATE
+// ----------------------------------------------------------------------------
+// Compact state: number of bits of a counter up to maxValue & the smallest type holding a number of bits
+constexpr uint8_t encoderCounterBits(uint16_t maxValue) {
+    return maxValue ? 1 + encoderCounterBits(maxValue >> 1) : 0;
+}
+
+template <uint8_t bytes>
+struct EncoderBitfield {
+    typedef uint32_t type;
+};
+
+template <>
+struct EncoderBitfield<1> {
+    typedef uint8_t type;
+};
+
+template <>
+struct EncoderBitfield<2> {
+    typedef uint16_t type;
+};
+#endif
+
 TEMPLATE_DEFINITION
 class ClickEncoder {
+#ifdef ROTARY_ISR_SERVICE
+    static_assert(Decoder::filterDepth == 0, "A FilteredDecoder needs periodic samples, it can not be used with ROTARY_ISR_SERVICE!");
+#endif
+
   public:
     static void init();
 
     static inline void service() __attribute__((always_inline));
+
+    // The two halves of service() for ClickEncoderSet: rotary decoding & acceleration at the service rate,
+    // one button check without any timing (to be called every buttonInterval service calls)
+    static inline void serviceEncoder() __attribute__((always_inline));
+    static inline void serviceButton() __attribute__((always_inline));
+    // Requests the ADC conversion of an analog button, to be called one service tick before serviceButton()
+    static inline void prepareButton() __attribute__((always_inline));
+    // Lets the ADC conversions progress between the button checks of an analog button
+    static inline void pollButton() __attribute__((always_inline));
+#ifndef WITHOUT_BUTTON
+    static const uint8_t buttonInterval = pinBTN >= 0 ? ENC_BUTTONINTERVAL : 0;
+#else
+    static const uint8_t buttonInterval = 0;
+#endif
 #if defined(ROTARY_ISR_SERVICE) && defined(SPLIT_ROTARY_ISR_SERVICE)
     static inline bool servicePinA() __attribute__((always_inline));
     static inline bool servicePinB() __attribute__((always_inline));
@@ -173,52 +601,128 @@ class ClickEncoder {
   public:
 #endif
 
+    // Consumes at most one notch. Only the low 16 bits of the consumed steps are kept: more than 32767 pending
+    // steps wrap around and are reported in the opposite direction, so consume at least every 32767 steps.
     static int16_t getValue();
 
+    // Consumes all complete notches at once (remaining steps are kept) and applies the acceleration to the whole batch,
+    // with the same limit of 32767 pending steps as getValue()
+    static int32_t getValueBatch();
+
+    // Absolute position in notches (without acceleration), does not consume anything.
+    // With ENC_COMPACT_STATE only 16 bits of the steps are kept, the position wraps around every 65536 steps.
+    static int32_t getPosition();
+
 #ifndef WITHOUT_BUTTON
     static ButtonState getButtonState();
 #endif
 
+#ifdef BUTTON_ISR_SERVICE
+    // To be called by the pin change interrupt of the button, returns if a toggle was detected
+    static inline bool serviceButtonEdge() __attribute__((always_inline));
+    // Returns false if the button is idle and the acceleration has decayed, else the millis() at which service() has to be called next
+    static bool nextButtonDeadline(unsigned long &deadline);
+#endif
+
+#ifdef ENC_EVENT_QUEUE_SIZE
+    // Pops the oldest event, returns false if there is none
+    static bool getEvent(EncoderEvent &event);
+    // Pops up to maxEvents events at once, returns the number of events written
+    static uint8_t getEvents(EncoderEvent *eventBuffer, uint8_t maxEvents);
+    // Returns true if button events were lost due to a full queue since the last call.
+    // Rotation is never lost, it gets accumulated until there is space in the queue again.
+    static bool getEventQueueOverflow();
+#endif
+
+#ifdef ENC_STATISTICS
+    // Consistent snapshot of all counters, even if the service routines interrupt the copy
+    static void getStatistics(EncoderStatistics &stats);
+#endif
+
 #ifndef WITHOUT_BUTTON
 
     static inline void setDoubleClickEnabled(bool d) {
-        doubleClickEnabled = d;
+#ifdef BUTTON_ISR_SERVICE
+        // The button ticks which were not evaluated yet still have to see the previous setting
+        EncoderInterruptLock lock;
+        if (pinBTN >= 0) {
+            advanceButton(millis());
+        }
+        settings.doubleClickEnabled = d;
+#else
+        settings.doubleClickEnabled = d;
+#endif
     }
 
     static inline bool getDoubleClickEnabled() __attribute__((always_inline)) {
-        return doubleClickEnabled;
+        return settings.doubleClickEnabled;
     }
 
     static inline void setButtonHeldEnabled(bool d) {
-        buttonHeldEnabled = d;
+#ifdef BUTTON_ISR_SERVICE
+        // The button ticks which were not evaluated yet still have to see the previous setting
+        EncoderInterruptLock lock;
+        if (pinBTN >= 0) {
+            advanceButton(millis());
+        }
+        settings.buttonHeldEnabled = d;
+#else
+        settings.buttonHeldEnabled = d;
+#endif
     }
 
     static inline bool getButtonHeldEnabled() __attribute__((always_inline)) {
-        return buttonHeldEnabled;
+        return settings.buttonHeldEnabled;
     }
 #endif
 
     static inline void setAccelerationEnabled(bool a) {
-        accelerationEnabled = a;
-        if (!accelerationEnabled) {
-            acceleration = 0;
-        }
+        settings.accelerationEnabled = a;
+        if (!settings.accelerationEnabled) {
 #ifdef ROTARY_ACCEL_OPTIMIZATION
-        else {
+            acceleration = 0;
+        } else {
             // Reset acceleration change counters
-            accelDec = 0;
-            accelInc = 0;
-        }
+            rotary.accelDec = 0;
+            rotary.accelInc = 0;
+#else
+            rotary.acceleration = 0;
 #endif
+        }
     }
 
     static inline bool getAccelerationEnabled() __attribute__((always_inline)) {
-        return accelerationEnabled;
+        return settings.accelerationEnabled;
     }
 
   private:
     static inline void incAcceleration() __attribute__((always_inline));
     static inline void decAcceleration() __attribute__((always_inline));
+#ifdef ROTARY_ACCEL_OPTIMIZATION
+    // Applies the acceleration change counters, by the consumer and with BUTTON_ISR_SERVICE by service()
+    static inline void foldAcceleration() __attribute__((always_inline));
+#endif
+    static inline int16_t getAcceleration() __attribute__((always_inline));
+#ifdef ROTARY_ACCEL_TIMESTAMPS
+    static inline uint16_t decayedAcceleration(uint16_t accel, unsigned long elapsedMillis) __attribute__((always_inline));
+#endif
+    static inline int32_t getPendingSteps() __attribute__((always_inline));
+    static inline uint8_t readPins() __attribute__((always_inline));
+    static inline bool decode(typename Decoder::state_t _last, uint8_t pins) __attribute__((always_inline));
+
+#ifndef WITHOUT_BUTTON
+    static inline void setButtonState(ButtonState state) __attribute__((always_inline));
+    static inline void serviceButtonTick(bool keyDown) __attribute__((always_inline));
+#endif
+#ifdef BUTTON_ISR_SERVICE
+    static inline unsigned long idleButtonTicks(bool keyDown, uint16_t _keyDownTicks, uint16_t _doubleClickTicks) __attribute__((always_inline));
+    static inline bool accelerationDeadline(unsigned long now, unsigned long &deadline) __attribute__((always_inline));
+    static void advanceButton(unsigned long now);
+#endif
+#ifdef ENC_EVENT_QUEUE_SIZE
+    static inline void queueRotation() __attribute__((always_inline));
+    static inline bool flushRotation() __attribute__((always_inline));
+#endif
 
 #ifndef WITHOUT_BUTTON
   protected:
@@ -226,66 +730,215 @@ class ClickEncoder {
 #endif
 
   protected:
-    static bool accelerationEnabled;
-    static volatile int8_t delta;
-    static volatile int8_t last;
-#ifndef ROTARY_ACCEL_OPTIMIZATION
-    static volatile uint16_t acceleration;
+    // Only written by the application, read by the service routines
+    struct Settings {
+#ifdef ENC_COMPACT_STATE
+        bool accelerationEnabled : 1;
+#ifndef WITHOUT_BUTTON
+        bool doubleClickEnabled : 1;
+        bool buttonHeldEnabled : 1;
+#endif
 #else
+        bool accelerationEnabled;
+#ifndef WITHOUT_BUTTON
+        bool doubleClickEnabled;
+        bool buttonHeldEnabled;
+#endif
+#endif
+    };
+
+    static Settings settings;
+
+#ifdef ENC_COMPACT_STATE
+    // Low 16 bits of millis(), kept at most ENC_ACCEL_TOP ms behind by service() (see decAcceleration())
+    typedef uint16_t accelTick_t;
+    // Low 16 bits of the step position, getPosition() wraps around with it
+    typedef int16_t position_t;
+#else
+    typedef unsigned long accelTick_t;
+    typedef int32_t position_t;
+#endif
+
+    // Written by the rotary service routines on every call or step, kept together in memory.
+    // Without padding in compact mode, so the size is the same on every platform.
+#ifdef ENC_COMPACT_STATE
+    struct __attribute__((packed)) Rotary {
+#else
+    struct Rotary {
+#endif
+#if defined(ROTARY_ACCEL_TIMESTAMPS)
+        // millis() of the last acceleration update, the deceleration since then is applied lazily
+        volatile accelTick_t accelerationUpdate;
+#endif
+        // Absolute step position
+        volatile position_t delta;
+#ifndef ROTARY_ACCEL_OPTIMIZATION
+        volatile uint16_t acceleration;
+#endif
+        // Decoder state
+        volatile typename Decoder::state_t last;
+#ifdef ROTARY_ACCEL_OPTIMIZATION
+        volatile uint8_t accelDec;
+        volatile uint8_t accelInc;
+#endif
+    };
+
+    static Rotary rotary;
+#ifdef ROTARY_ACCEL_OPTIMIZATION
+    // Folded by the consumer, with BUTTON_ISR_SERVICE also by service()
     static uint16_t acceleration;
-    static volatile uint8_t accelDec;
-    static volatile uint8_t accelInc;
 #endif
 
+    // Low 16 bits only, the pending steps are the difference to the position modulo 2^16
+    typedef int16_t consumed_t;
+    // Steps that were already consumed, only written by the consumer (getValue() & co. or the event queue)
+    static volatile consumed_t consumed;
+
 #ifndef WITHOUT_BUTTON
-    static bool doubleClickEnabled;
-    static bool buttonHeldEnabled;
-    static uint16_t keyDownTicks;
-    static uint16_t doubleClickTicks;
-#ifndef ROTARY_ISR_SERVICE
-    static unsigned long lastButtonCheck;
+#ifdef ENC_COMPACT_STATE
+    // The counters are narrowed to the largest values the button logic distinguishes, keyDownTicks saturates.
+    // Both are only written by the service routines and share one bitfield.
+    static const uint16_t keyDownTicksLimit = (buttonHoldTime / ENC_BUTTONINTERVAL) < 2 ? 2 : (buttonHoldTime / ENC_BUTTONINTERVAL) < 0xFFFF ? (buttonHoldTime / ENC_BUTTONINTERVAL) + 1 : 0xFFFF;
+    // At least 1 for single clicks (ENC_SINGLECLICKONLY)
+    static const uint16_t doubleClickTicksLimit = (buttonDoubleClickTime / ENC_BUTTONINTERVAL) < 1 ? 1 : (buttonDoubleClickTime / ENC_BUTTONINTERVAL);
+#ifdef BUTTON_ISR_SERVICE
+    static const uint8_t buttonBits = encoderCounterBits(keyDownTicksLimit) + encoderCounterBits(doubleClickTicksLimit) + 1;
+#else
+    static const uint8_t buttonBits = encoderCounterBits(keyDownTicksLimit) + encoderCounterBits(doubleClickTicksLimit);
+#endif
+    typedef typename EncoderBitfield<(buttonBits + 7) / 8>::type buttonBitfield_t;
+
+    struct ButtonCounters {
+        buttonBitfield_t keyDownTicks : encoderCounterBits(keyDownTicksLimit);
+        buttonBitfield_t doubleClickTicks : encoderCounterBits(doubleClickTicksLimit);
+#ifdef BUTTON_ISR_SERVICE
+        // Pin state since the last edge
+        buttonBitfield_t pinActive : 1;
+#endif
+    };
+
+    // Written by both the service routines & getButtonState(), therefore not part of a bitfield
+    typedef uint8_t buttonState_t;
+    // Low byte of millis(), service() has to be called at least every 256 - ENC_BUTTONINTERVAL ms
+    typedef uint8_t buttonCheck_t;
+    // Low 16 bits of millis(), service() has to be called within 65 s after nextButtonDeadline()
+    typedef uint16_t buttonTick_t;
+#else
+    static const uint16_t keyDownTicksLimit = 0xFFFF;
+
+    struct ButtonCounters {
+        uint16_t keyDownTicks;
+        uint16_t doubleClickTicks;
+#ifdef BUTTON_ISR_SERVICE
+        // Pin state since the last edge
+        bool pinActive;
+#endif
+    };
+
+    typedef ButtonState buttonState_t;
+    typedef unsigned long buttonCheck_t;
+    typedef unsigned long buttonTick_t;
 #endif
-    static volatile ButtonState buttonState;
+
+    static volatile ButtonCounters button;
+#if defined(BUTTON_ISR_SERVICE)
+    // millis() of the last emulated button tick
+    static volatile buttonTick_t buttonTickMillis;
+#elif !defined(ROTARY_ISR_SERVICE)
+    static buttonCheck_t lastButtonCheck;
+#endif
+    static volatile buttonState_t buttonState;
+#endif
+#if defined(BUTTON_ISR_SERVICE) && !defined(ROTARY_ACCEL_TIMESTAMPS)
+    // Low byte of millis() of the last deceleration, see nextButtonDeadline()
+    static volatile uint8_t lastDecAcceleration;
+#endif
+#ifdef ENC_EVENT_QUEUE_SIZE
+    static EncoderEventQueue<ENC_EVENT_QUEUE_SIZE> events;
+    static volatile bool eventQueueOverflow;
+    // Notches that did not fit into the queue yet, only written by the service routines.
+    // Split into several events when they exceed an int16_t.
+    static volatile int32_t pendingNotches;
+    static uint16_t pendingTimestamp;
 #endif
-#if ENC_DECODER != ENC_NORMAL
-    static const int8_t table[16];
+#ifdef ENC_STATISTICS
+    // Accessed through memory barriers instead of volatile, so that snapshots can be copied at once
+    static EncoderStatistics statistics;
+    // The pins of the last sample were an illegal transition, only accessed by the service routines
+    static bool illegalPins;
+#endif
+
+#ifdef ENC_COMPACT_STATE
+  public:
+    // Bytes of RAM used by this encoder, without the event queue & the statistics
+    static const uint8_t stateBytes = sizeof(settings) + sizeof(rotary) + sizeof(consumed)
+#ifdef ROTARY_ACCEL_OPTIMIZATION
+                                      + sizeof(acceleration)
+#endif
+#ifndef WITHOUT_BUTTON
+                                      + sizeof(button) + sizeof(buttonState)
+#if defined(BUTTON_ISR_SERVICE)
+                                      + sizeof(buttonTickMillis)
+#elif !defined(ROTARY_ISR_SERVICE)
+                                      + sizeof(lastButtonCheck)
+#endif
+#endif
+#if defined(BUTTON_ISR_SERVICE) && !defined(ROTARY_ACCEL_TIMESTAMPS)
+                                      + sizeof(lastDecAcceleration)
+#endif
+        ;
+
+    static_assert(stateBytes <= ENC_COMPACT_STATE, "The state of this encoder exceeds the ENC_COMPACT_STATE byte budget!");
 #endif
 };
 
 #ifndef WITHOUT_BUTTON
 TEMPLATE_TYPES
-volatile ButtonState ClickEncoder<TEMPLATE_TYPE_NAMES>::buttonState = Open;
+volatile typename ClickEncoder<TEMPLATE_TYPE_NAMES>::buttonState_t ClickEncoder<TEMPLATE_TYPE_NAMES>::buttonState = Open;
 TEMPLATE_TYPES
-bool ClickEncoder<TEMPLATE_TYPE_NAMES>::doubleClickEnabled = true;
+volatile typename ClickEncoder<TEMPLATE_TYPE_NAMES>::ButtonCounters ClickEncoder<TEMPLATE_TYPE_NAMES>::button = {};
+#if defined(BUTTON_ISR_SERVICE)
 TEMPLATE_TYPES
-bool ClickEncoder<TEMPLATE_TYPE_NAMES>::buttonHeldEnabled = true;
+volatile typename ClickEncoder<TEMPLATE_TYPE_NAMES>::buttonTick_t ClickEncoder<TEMPLATE_TYPE_NAMES>::buttonTickMillis = 0;
+#elif !defined(ROTARY_ISR_SERVICE)
 TEMPLATE_TYPES
-uint16_t ClickEncoder<TEMPLATE_TYPE_NAMES>::keyDownTicks = 0;
+typename ClickEncoder<TEMPLATE_TYPE_NAMES>::buttonCheck_t ClickEncoder<TEMPLATE_TYPE_NAMES>::lastButtonCheck = 0;
+#endif
 TEMPLATE_TYPES
-uint16_t ClickEncoder<TEMPLATE_TYPE_NAMES>::doubleClickTicks = 0;
-#ifndef ROTARY_ISR_SERVICE
+typename ClickEncoder<TEMPLATE_TYPE_NAMES>::Settings ClickEncoder<TEMPLATE_TYPE_NAMES>::settings = {true, true, true};
+#else
 TEMPLATE_TYPES
-unsigned long ClickEncoder<TEMPLATE_TYPE_NAMES>::lastButtonCheck = 0;
-#endif
+typename ClickEncoder<TEMPLATE_TYPE_NAMES>::Settings ClickEncoder<TEMPLATE_TYPE_NAMES>::settings = {true};
 #endif
 
 TEMPLATE_TYPES
-bool ClickEncoder<TEMPLATE_TYPE_NAMES>::accelerationEnabled = true;
+typename ClickEncoder<TEMPLATE_TYPE_NAMES>::Rotary ClickEncoder<TEMPLATE_TYPE_NAMES>::rotary = {};
+#ifdef ROTARY_ACCEL_OPTIMIZATION
 TEMPLATE_TYPES
-volatile int8_t ClickEncoder<TEMPLATE_TYPE_NAMES>::delta = 0;
+uint16_t ClickEncoder<TEMPLATE_TYPE_NAMES>::acceleration = 0;
+#endif
 TEMPLATE_TYPES
-volatile int8_t ClickEncoder<TEMPLATE_TYPE_NAMES>::last = 0;
+volatile typename ClickEncoder<TEMPLATE_TYPE_NAMES>::consumed_t ClickEncoder<TEMPLATE_TYPE_NAMES>::consumed = 0;
 
-#ifndef ROTARY_ACCEL_OPTIMIZATION
+#if defined(BUTTON_ISR_SERVICE) && !defined(ROTARY_ACCEL_TIMESTAMPS)
 TEMPLATE_TYPES
-volatile uint16_t ClickEncoder<TEMPLATE_TYPE_NAMES>::acceleration = 0;
-#else
+volatile uint8_t ClickEncoder<TEMPLATE_TYPE_NAMES>::lastDecAcceleration = 0;
+#endif
+#ifdef ENC_EVENT_QUEUE_SIZE
 TEMPLATE_TYPES
-uint16_t ClickEncoder<TEMPLATE_TYPE_NAMES>::acceleration = 0;
+EncoderEventQueue<ENC_EVENT_QUEUE_SIZE> ClickEncoder<TEMPLATE_TYPE_NAMES>::events = {};
+TEMPLATE_TYPES
+volatile bool ClickEncoder<TEMPLATE_TYPE_NAMES>::eventQueueOverflow = false;
+TEMPLATE_TYPES
+volatile int32_t ClickEncoder<TEMPLATE_TYPE_NAMES>::pendingNotches = 0;
+TEMPLATE_TYPES
+uint16_t ClickEncoder<TEMPLATE_TYPE_NAMES>::pendingTimestamp = 0;
+#endif
+#ifdef ENC_STATISTICS
 TEMPLATE_TYPES
-volatile uint8_t ClickEncoder<TEMPLATE_TYPE_NAMES>::accelDec = 0;
+EncoderStatistics ClickEncoder<TEMPLATE_TYPE_NAMES>::statistics = {};
 TEMPLATE_TYPES
-volatile uint8_t ClickEncoder<TEMPLATE_TYPE_NAMES>::accelInc = 0;
+bool ClickEncoder<TEMPLATE_TYPE_NAMES>::illegalPins = false;
 #endif
 // ----------------------------------------------------------------------------
 
@@ -295,6 +948,7 @@ volatile uint8_t ClickEncoder<TEMPLATE_TYPE_NAMES>::accelInc = 0;
 #undef DEFAULT_ENC_ACCEL_INC
 #undef DEFAULT_ENC_ACCEL_DEC
 #undef DEFAULT_STEPS_PER_NOTCH
+#undef DEFAULT_ENC_DECODER
 #undef TEMPLATE_PARAMETERS
 #undef TEMPLATE_TYPES
 #undef TEMPLATE_TYPE_NAMES
@@ -11,21 +11,252 @@
 
 // ----------------------------------------------------------------------------
 
-#if ENC_DECODER != ENC_NORMAL
-#if ENC_HALFSTEP
-// decoding table for hardware with flaky notch (half resolution)
-TEMPLATE_TYPES
-const int8_t ClickEncoder<TEMPLATE_TYPE_NAMES>::table[16] __attribute__((__progmem__)) = {
-    0, 0, -1, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, -1, 0, 0};
+#include <FastPin.h>
+
+// ----------------------------------------------------------------------------
+// Analog read split into two steps, so that the service routines never wait for the ADC:
+// start() requests a conversion, result() returns the value of the last completed one.
+// The button checks request their conversion one service tick ahead, see check().
+// On AVR the conversions run in the background. The ADC is shared by all analog buttons, so the
+// conversions are scheduled round robin: every call collects a completed conversion into the storage of
+// the User which requested it and starts the next requested one. If the ADC is busy with the conversion
+// of another User, result() keeps returning the previous value.
+// Other platforms read the value synchronously within result().
+#if defined(ADCSRA) && defined(ADMUX)
+struct AsyncAnalogReadNode {
+    AsyncAnalogReadNode *next;
+    volatile int16_t value;
+    uint8_t channel; // bit 3 = MUX5
+    // Waiting for a conversion, until it got collected
+    volatile bool requested;
+};
+
+template <typename Unused = void>
+struct AsyncAnalogReadScheduler {
+    static void add(AsyncAnalogReadNode &node);
+    static void run();
+    static int16_t read(uint8_t pin);
+
+    static inline uint8_t channel(uint8_t pin) __attribute__((always_inline)) {
+        uint8_t channel = pin >= A0 ? pin - A0 : pin;
+#if defined(analogPinToChannel)
+        channel = analogPinToChannel(channel);
+#endif
+        return channel;
+    }
+
+    static inline bool busy() __attribute__((always_inline)) {
+        return ADCSRA & _BV(ADSC);
+    }
+
+    // The reference selection bits of ADMUX are never changed, see AsyncAnalogRead::init()
+    static inline bool selected(uint8_t channel) __attribute__((always_inline)) {
+#if defined(ADCSRB) && defined(MUX5)
+        if (((ADCSRB >> MUX5) & 0x01) != ((channel >> 3) & 0x01)) {
+            return false;
+        }
+#endif
+        return (ADMUX & ~(_BV(REFS1) | _BV(REFS0))) == (channel & 0x07);
+    }
+
+    static inline void convert(uint8_t channel) __attribute__((always_inline)) {
+#if defined(ADCSRB) && defined(MUX5)
+        ADCSRB = (ADCSRB & ~_BV(MUX5)) | (((channel >> 3) & 0x01) << MUX5);
+#endif
+        ADMUX = (ADMUX & (_BV(REFS1) | _BV(REFS0))) | (channel & 0x07);
+        ADCSRA |= _BV(ADSC);
+    }
+
+    // Collects the completed conversion of current, expects the ADC not to be busy
+    static inline void collect() __attribute__((always_inline)) {
+        pending = false;
+        if (selected(current->channel)) {
+            current->value = ADC;
+            current->requested = false;
+            --requests;
+        }
+        // Else an analogRead() of another pin through the core overwrote the result, which is requested again
+    }
+
+    // All Users, in reverse order of add()
+    static AsyncAnalogReadNode *first;
+    // User of the last started conversion, the next one is searched from here on
+    static AsyncAnalogReadNode *current;
+    // The conversion of current was not collected yet
+    static bool pending;
+    // Number of Users waiting for a conversion, incl. the running one
+    static uint8_t requests;
+    // The ADC is used by read(), the service routines must not touch it
+    static volatile bool reserved;
+};
+
+template <typename Unused>
+AsyncAnalogReadNode *AsyncAnalogReadScheduler<Unused>::first = 0;
+template <typename Unused>
+AsyncAnalogReadNode *AsyncAnalogReadScheduler<Unused>::current = 0;
+template <typename Unused>
+bool AsyncAnalogReadScheduler<Unused>::pending = false;
+template <typename Unused>
+uint8_t AsyncAnalogReadScheduler<Unused>::requests = 0;
+template <typename Unused>
+volatile bool AsyncAnalogReadScheduler<Unused>::reserved = false;
+
+template <typename Unused>
+void AsyncAnalogReadScheduler<Unused>::add(AsyncAnalogReadNode &node) {
+    for (AsyncAnalogReadNode *n = first; n; n = n->next) {
+        if (n == &node) {
+            return;
+        }
+    }
+    node.next = first;
+    first = &node;
+    if (!current) {
+        current = &node;
+    }
+}
+
+template <typename Unused>
+void AsyncAnalogReadScheduler<Unused>::run() {
+    // Nothing to collect & nothing to start, as for most of the calls between the button checks
+    if (!pending && !requests) {
+        return;
+    }
+
+    // Never switch the multiplexer during a conversion
+    if (reserved || busy()) {
+        return;
+    }
+
+    if (pending) {
+        collect();
+    }
+
+    if (!requests) {
+        return;
+    }
+
+    // Round robin, the User of the last conversion comes last
+    AsyncAnalogReadNode *last = current;
+    AsyncAnalogReadNode *node = current;
+    do {
+        node = node->next ? node->next : first;
+        if (node->requested) {
+            current = node;
+            pending = true;
+            convert(node->channel);
+            return;
+        }
+    } while (node != last);
+}
+
+// The service routines leave their conversion running in the background, so the core's analogRead()
+// would return it instead of the value of its own pin. The application therefore reads through the
+// scheduler: it waits for the running conversion, collects it for its User, converts the pin and
+// lets the service routines continue afterwards. Interrupts are only disabled while switching the ADC.
+template <typename Unused>
+int16_t AsyncAnalogReadScheduler<Unused>::read(uint8_t pin) {
+    uint8_t _channel = channel(pin);
+    for (;;) {
+        EncoderInterruptLock lock;
+        if (!busy()) {
+            if (pending) {
+                collect();
+            }
+            reserved = true;
+            convert(_channel);
+            break;
+        }
+    }
+
+    while (busy()) {
+    }
+    int16_t value = ADC;
+
+    EncoderInterruptLock lock;
+    reserved = false;
+    run();
+    return value;
+}
+#endif
+
+// Synchronous analogRead() for the application, which shares the ADC with analog buttons &
+// ClickButtonLadders. Use it instead of analogRead(), which would collide with their conversions.
+inline int16_t encoderAnalogRead(uint8_t pin) {
+#if defined(ADCSRA) && defined(ADMUX)
+    return AsyncAnalogReadScheduler<>::read(pin);
 #else
-// decoding table for normal hardware
-TEMPLATE_TYPES
-const int8_t ClickEncoder<TEMPLATE_TYPE_NAMES>::table[16] __attribute__((__progmem__)) = {
-    0, 1, -1, 0, -1, 0, 0, 1, 1, 0, 0, -1, 0, -1, 1, 0};
+    return analogRead(pin);
 #endif
+}
+
+template <int8_t pin, typename User>
+struct AsyncAnalogRead {
+#if defined(ADCSRA) && defined(ADMUX)
+    // A synchronous read through the core selects the reference set by analogReference(), which is kept
+    // by all following conversions. Switching to another reference while a voltage is applied to AREF
+    // would short it with AVcc.
+    static inline void init() {
+        node.value = FastPin<pin>::analogRead();
+        node.channel = AsyncAnalogReadScheduler<>::channel(pin);
+
+        // The service routines of the other Users might already run the scheduler
+        EncoderInterruptLock lock;
+        AsyncAnalogReadScheduler<>::add(node);
+        start();
+    }
+
+    static inline void start() __attribute__((always_inline)) {
+        if (!node.requested) {
+            node.requested = true;
+            ++AsyncAnalogReadScheduler<>::requests;
+        }
+        AsyncAnalogReadScheduler<>::run();
+    }
+
+    static inline int16_t result() __attribute__((always_inline)) {
+        AsyncAnalogReadScheduler<>::run();
+        return node.value;
+    }
+
+    // Lets the conversions of all Users progress between two button checks
+    static inline void poll() __attribute__((always_inline)) {
+        AsyncAnalogReadScheduler<>::run();
+    }
+
+    // Value for a button check. The conversion is requested by start() one service tick before the check,
+    // so it usually completed in between. If not (the service routines are not called every 1ms), the
+    // conversion for the next check is requested here, which then sees the value of this one.
+    static inline int16_t check() __attribute__((always_inline)) {
+        bool prepared = node.requested;
+        int16_t value = result();
+        if (!prepared) {
+            start();
+        }
+        return value;
+    }
+
+    static AsyncAnalogReadNode node;
+#else
+    static inline void init() {}
+
+    static inline void start() __attribute__((always_inline)) {}
+
+    static inline int16_t result() __attribute__((always_inline)) {
+        return FastPin<pin>::analogRead();
+    }
+
+    static inline void poll() __attribute__((always_inline)) {}
+
+    static inline int16_t check() __attribute__((always_inline)) {
+        return FastPin<pin>::analogRead();
+    }
 #endif
+};
 
-#include <FastPin.h>
+#if defined(ADCSRA) && defined(ADMUX)
+template <int8_t pin, typename User>
+AsyncAnalogReadNode AsyncAnalogRead<pin, User>::node = {};
+#endif
 
 // ----------------------------------------------------------------------------
 TEMPLATE_TYPES
@@ -54,108 +285,233 @@ void ClickEncoder<TEMPLATE_TYPE_NAMES>::init() {
 #endif
     }
 
-    if (FastPin<pinA>::digitalRead() == pinsActive) {
-        last = 3;
+#ifndef WITHOUT_BUTTON
+    if (analogInput && pinBTN >= 0) {
+        // The first button check collects the conversion started here
+        AsyncAnalogRead<pinBTN, ClickEncoder>::init();
     }
+#endif
 
-    if (FastPin<pinB>::digitalRead() == pinsActive) {
-        last ^= 1;
+#ifdef BUTTON_ISR_SERVICE
+    // Checked here, as an application might never instantiate serviceButtonEdge()
+    static_assert(!analogInput, "BUTTON_ISR_SERVICE does not support analog buttons!");
+    if (pinBTN >= 0) {
+        button.pinActive = getPinState() == pinsActive;
+        buttonTickMillis = (buttonTick_t)millis();
     }
+#endif
+
+    rotary.last = Decoder::initialState(readPins());
 }
 
 // ----------------------------------------------------------------------------
 
+#ifdef ROTARY_ACCEL_TIMESTAMPS
+TEMPLATE_TYPES
+uint16_t ClickEncoder<TEMPLATE_TYPE_NAMES>::decayedAcceleration(uint16_t accel, unsigned long elapsedMillis) {
+    // Prevent an overflow of the multiplication, as we would have decelerated to 0 anyway
+    if (ENC_ACCEL_DEC && elapsedMillis >= ENC_ACCEL_TOP) {
+        return 0;
+    }
+
+    unsigned long decrease = elapsedMillis * ENC_ACCEL_DEC;
+    return decrease >= accel ? 0 : accel - decrease;
+}
+#endif
+
 TEMPLATE_TYPES
 void ClickEncoder<TEMPLATE_TYPE_NAMES>::incAcceleration() {
-#ifndef ROTARY_ACCEL_OPTIMIZATION
-    if (accelerationEnabled) {
+#if defined(ROTARY_ACCEL_TIMESTAMPS)
+    if (settings.accelerationEnabled) {
+        unsigned long now = millis();
+        // Apply the deceleration since the last step, then accelerate.
+        // This equals decAcceleration() every 1ms followed by incAcceleration() without a periodic tick
+        uint16_t increasedAcc = decayedAcceleration(rotary.acceleration, (accelTick_t)(now - rotary.accelerationUpdate)) + ENC_ACCEL_INC;
+        rotary.acceleration = increasedAcc < ENC_ACCEL_TOP ? increasedAcc : ENC_ACCEL_TOP;
+        rotary.accelerationUpdate = (accelTick_t)now;
+#ifdef ENC_STATISTICS
+        if (increasedAcc >= ENC_ACCEL_TOP) {
+            ++statistics.accelerationTopHits;
+        }
+#endif
+    }
+#elif !defined(ROTARY_ACCEL_OPTIMIZATION)
+    if (settings.accelerationEnabled) {
         // increment accelerator if encoder has been moved
-        uint16_t increasedAcc = acceleration + ENC_ACCEL_INC;
+        uint16_t increasedAcc = rotary.acceleration + ENC_ACCEL_INC;
         // Apply acceleration changes
         // We ignore overflows here because it is very unlikely to achieve a accerleration which exceeds 65535
-        acceleration = increasedAcc < ENC_ACCEL_TOP ? increasedAcc : ENC_ACCEL_TOP;
+        rotary.acceleration = increasedAcc < ENC_ACCEL_TOP ? increasedAcc : ENC_ACCEL_TOP;
+#ifdef ENC_STATISTICS
+        if (increasedAcc >= ENC_ACCEL_TOP) {
+            ++statistics.accelerationTopHits;
+        }
+#endif
     }
 #else
     // We can always change this field as it is faster than checking first if acceleration is anabled
-    ++accelInc;
+    ++rotary.accelInc;
+#ifdef ENC_STATISTICS
+    // Counted per step like without the optimization, from the acceleration the next fold computes.
+    // acceleration might be folded concurrently by the consumer, which at worst miscounts this step.
+    if (settings.accelerationEnabled && (int32_t)acceleration + rotary.accelInc * ENC_ACCEL_INC - rotary.accelDec * ENC_ACCEL_DEC >= ENC_ACCEL_TOP) {
+        ++statistics.accelerationTopHits;
+    }
+#endif
 #endif
 }
 
+#ifdef ROTARY_ACCEL_OPTIMIZATION
+TEMPLATE_TYPES
+void ClickEncoder<TEMPLATE_TYPE_NAMES>::foldAcceleration() {
+    int16_t accelChange = rotary.accelInc * ENC_ACCEL_INC - rotary.accelDec * ENC_ACCEL_DEC;
+    acceleration += accelChange;
+
+    if (acceleration > ENC_ACCEL_TOP) {
+        acceleration = accelChange < 0 ? 0 : ENC_ACCEL_TOP;
+    }
+
+    // Reset acceleration change counters
+    rotary.accelDec = 0;
+    rotary.accelInc = 0;
+}
+#endif
+
 TEMPLATE_TYPES
 void ClickEncoder<TEMPLATE_TYPE_NAMES>::decAcceleration() {
-#ifndef ROTARY_ACCEL_OPTIMIZATION
-    if (accelerationEnabled) {
-        uint16_t nextAcceleration = acceleration;
+#if defined(ROTARY_ACCEL_TIMESTAMPS)
+    // Deceleration is derived from the step timestamps, nothing to do per tick
+#ifdef ENC_COMPACT_STATE
+    // Except keeping the 16 bit timestamp from wrapping around: after ENC_ACCEL_TOP ms the acceleration
+    // has decayed to 0, which is recorded, so the timestamp does not matter anymore. A step in between at
+    // worst loses the ENC_ACCEL_INC of this one step.
+    if (ENC_ACCEL_DEC && rotary.acceleration) {
+        unsigned long now = millis();
+        if ((accelTick_t)(now - rotary.accelerationUpdate) > ENC_ACCEL_TOP) {
+            rotary.acceleration = 0;
+        }
+    }
+#endif
+#elif !defined(ROTARY_ACCEL_OPTIMIZATION)
+#ifdef BUTTON_ISR_SERVICE
+    lastDecAcceleration = (uint8_t)millis();
+#endif
+    if (settings.accelerationEnabled) {
+        uint16_t nextAcceleration = rotary.acceleration;
         // decelerate every tick
         uint16_t decreasedAcc = nextAcceleration - ENC_ACCEL_DEC;
         // handle underflow
         // Apply acceleration changes
-        acceleration = decreasedAcc > nextAcceleration ? 0 : decreasedAcc;
+        rotary.acceleration = decreasedAcc > nextAcceleration ? 0 : decreasedAcc;
     }
 #else
+#ifdef BUTTON_ISR_SERVICE
+    lastDecAcceleration = (uint8_t)millis();
+#endif
     // We can always change this field as it is faster than checking first if acceleration is anabled
-    ++accelDec;
+    ++rotary.accelDec;
+#ifdef BUTTON_ISR_SERVICE
+    // service() only runs at the deadlines, which stop once the folded acceleration decayed to 0
+    if (settings.accelerationEnabled) {
+        foldAcceleration();
+    }
+#endif
 #endif
 }
 
-#if defined(ROTARY_ISR_SERVICE) && defined(SPLIT_ROTARY_ISR_SERVICE)
-#define _LAST_PIN_A_STATE_MASK _BV(7)
-#define _LAST_PIN_B_STATE_MASK _BV(6)
-
+// Pin levels as (A << 1 | B), 1 = active
 TEMPLATE_TYPES
-bool ClickEncoder<TEMPLATE_TYPE_NAMES>::servicePinA() {
+uint8_t ClickEncoder<TEMPLATE_TYPE_NAMES>::readPins() {
+    return ((FastPin<pinA>::digitalRead() == pinsActive) << 1) | (FastPin<pinB>::digitalRead() == pinsActive);
+}
 
-    int8_t _last = last;
+// A single table lookup yields the next state & the detected step, returns if a step was detected
+TEMPLATE_TYPES
+bool ClickEncoder<TEMPLATE_TYPE_NAMES>::decode(typename Decoder::state_t _last, uint8_t pins) {
+    typename Decoder::state_t entry = Decoder::next(_last, pins);
+
+    // Unchanged pins map onto the same state without a step, as for most of the calls. On AVR this early
+    // return costs a compare & a not taken branch (2 cycles), an unconditional update would cost the store of
+    // the state (2 cycles) plus the test of the step (2 cycles). On the host the store made service() 4x
+    // slower, as the next call has to wait for it. Peter Dannegger's decoder is cheaper as it needs no table.
+    if (entry == _last) {
+#ifdef ENC_STATISTICS
+        // Illegal transitions keep the last state as well. The pins stay different from the state
+        // until the next legal transition, so only the first of these samples is counted.
+        bool illegal = pins != Decoder::pins(_last);
+        if (illegal && !illegalPins) {
+            ++statistics.illegalTransitions;
+        }
+        illegalPins = illegal;
+#endif
+        return false;
+    }
 
-    bool lastPinAState = (_last & _LAST_PIN_A_STATE_MASK) == _LAST_PIN_A_STATE_MASK;
-    bool currentPinAState = FastPin<pinA>::digitalRead() == pinsActive;
+#ifdef ENC_STATISTICS
+    illegalPins = false;
+#endif
 
-    // Validate if there really was a toggle and this was not called due to jitter
-    if (currentPinAState != lastPinAState) {
-        int8_t curr = _last ^ 3 ^ _LAST_PIN_A_STATE_MASK;
+    rotary.last = Decoder::state(entry);
+
+    int8_t step = Decoder::step(entry);
+    if (step) {
+#ifdef ENC_STATISTICS
+        ++statistics.steps;
+        // The pending steps (see getPendingSteps()) wrap around with this step
+        // Largest number of pending steps consumed_t can hold
+        const consumed_t maxPending = (consumed_t)(0xFFFFFFFFul >> (33 - 8 * sizeof(consumed_t)));
+        if ((consumed_t)((uint32_t)rotary.delta - (uint32_t)consumed) == (step > 0 ? maxPending : (consumed_t)(-maxPending - 1))) {
+            ++statistics.deltaOverflows;
+        }
+#endif
+        rotary.delta += step;
+        incAcceleration();
+#if defined(ENC_EVENT_QUEUE_SIZE) && defined(ROTARY_ISR_SERVICE)
+        // service() might only run at the button deadlines, so the pin change interrupts queue the rotation
+        queueRotation();
+#endif
+    }
+    return step;
+}
 
-        last = curr;
+#if defined(ROTARY_ISR_SERVICE) && defined(SPLIT_ROTARY_ISR_SERVICE)
 
-        // Remove last pin state information
-        curr &= 0x03;
-        _last &= 0x03;
+// The level of the other pin is taken from the decoder state, so every decoder can be split.
+// If called due to jitter, the pin levels did not change and the decoder keeps its state.
+TEMPLATE_TYPES
+bool ClickEncoder<TEMPLATE_TYPE_NAMES>::servicePinA() {
 
-        int8_t diff = _last - curr;
+    typename Decoder::state_t _last = rotary.last;
 
-        delta += (diff & 0b010) - 1; // bit at index 1 = direction (1/0) means (+/-)
+    uint8_t lastPins = Decoder::pins(_last);
+    uint8_t pins = (lastPins & 0b01) | ((FastPin<pinA>::digitalRead() == pinsActive) << 1);
 
-        incAcceleration();
+    decode(_last, pins);
 
-        return true;
+#ifdef ENC_STATISTICS
+    if (pins == lastPins) {
+        ++statistics.jitterRejections;
     }
-    return false;
+#endif
+    return pins != lastPins;
 }
 
 TEMPLATE_TYPES
 bool ClickEncoder<TEMPLATE_TYPE_NAMES>::servicePinB() {
 
-    int8_t _last = last;
-
-    bool lastPinBState = (_last & _LAST_PIN_B_STATE_MASK) == _LAST_PIN_B_STATE_MASK;
-    bool currentPinBState = FastPin<pinB>::digitalRead() == pinsActive;
-
-    // Validate if there really was a toggle and this was not called due to jitter
-    if (currentPinBState != lastPinBState) {
-        int8_t curr = _last ^ 1 ^ _LAST_PIN_B_STATE_MASK;
-
-        last = curr;
-
-        // Remove last pin state information
-        curr &= 0x03;
-        _last &= 0x03;
+    typename Decoder::state_t _last = rotary.last;
 
-        delta += curr - _last;
+    uint8_t lastPins = Decoder::pins(_last);
+    uint8_t pins = (lastPins & 0b10) | (FastPin<pinB>::digitalRead() == pinsActive);
 
-        incAcceleration();
+    decode(_last, pins);
 
-        return true;
+#ifdef ENC_STATISTICS
+    if (pins == lastPins) {
+        ++statistics.jitterRejections;
     }
-    return false;
+#endif
+    return pins != lastPins;
 }
 #endif
 
@@ -163,49 +519,52 @@ bool ClickEncoder<TEMPLATE_TYPE_NAMES>::servicePinB() {
 // We expect that interrupts will be disabled during executing this function inside a ISR
 TEMPLATE_TYPES
 bool ClickEncoder<TEMPLATE_TYPE_NAMES>::rotaryService() {
-#if ENC_DECODER == ENC_FLAKY
-    last = (last << 2) & 0x0F;
-
-    if (FastPin<pinA>::digitalRead() == pinsActive) {
-        last |= 2;
-    }
+    return decode(rotary.last, readPins());
+}
+#endif
 
-    if (FastPin<pinB>::digitalRead() == pinsActive) {
-        last |= 1;
-    }
+// This function still needs to be polled... else we have no decreasing acceleration!
+// Except for ROTARY_ACCEL_TIMESTAMPS, where it is only needed for the button and, without ROTARY_ISR_SERVICE, for the rotary decoding
+TEMPLATE_TYPES
+void ClickEncoder<TEMPLATE_TYPE_NAMES>::service() {
 
-    int8_t tbl = pgm_read_byte(&table[last]);
-    if (tbl) {
-        delta += tbl;
-#elif ENC_DECODER == ENC_NORMAL
-    int8_t curr = 0;
+    serviceEncoder();
 
-    if (FastPin<pinA>::digitalRead() == pinsActive) {
-        curr = 3;
-    }
+    // handle buttonState
+#ifndef WITHOUT_BUTTON
+#if defined(ROTARY_ISR_SERVICE) || defined(BUTTON_ISR_SERVICE)
+    // NOTE: We expect that this routine does not get called with 1 kHz anymore, as this would be wasteful AF!
+    // Therefore it is expected that this service routine already gets called in the wanted ENC_BUTTONINTERVAL => simpler code
+    serviceButton();
+#else
+    // check buttonState only, if a pin has been provided
+    if (pinBTN >= 0) {
+        unsigned long currentMillis = millis();
 
-    if (FastPin<pinB>::digitalRead() == pinsActive) {
-        curr ^= 1;
+        // Handle case when millis() wraps back around to zero
+        // checking buttonState is sufficient every 10-30ms
+        buttonCheck_t elapsed = currentMillis - lastButtonCheck;
+        if (elapsed >= ENC_BUTTONINTERVAL) {
+            lastButtonCheck = currentMillis;
+            serviceButton();
+        } else if (analogInput) {
+            if (elapsed == ENC_BUTTONINTERVAL - 1) {
+                prepareButton();
+            } else {
+                pollButton();
+            }
+        }
     }
-
-    int8_t diff = last - curr;
-
-    bool detectedStep = (diff & 0b01) == 0b01;
-
-    if (detectedStep) { // bit at index 0 = step
-        last = curr;
-        delta += (diff & 0b010) - 1; // bit at index 1 = direction (1/0) means (+/-)
 #endif
-        incAcceleration();
-    }
-
-    return detectedStep;
+#endif // WITHOUT_BUTTON
 }
-#endif
 
-// This function still needs to be polled... else we have no decreasing acceleration!
 TEMPLATE_TYPES
-void ClickEncoder<TEMPLATE_TYPE_NAMES>::service() {
+void ClickEncoder<TEMPLATE_TYPE_NAMES>::serviceEncoder() {
+
+#ifdef ENC_STATISTICS
+    ++statistics.serviceCalls;
+#endif
 
     decAcceleration();
 
@@ -213,131 +572,450 @@ void ClickEncoder<TEMPLATE_TYPE_NAMES>::service() {
     rotaryService();
 #endif
 
-    // handle buttonState
-#ifndef WITHOUT_BUTTON
-
-// NOTE: We expect that this routine does not get called with 1 kHz anymore, as this would be wasteful AF!
-// Therefore it is expected that this service routine already gets called in the wanted ENC_BUTTONINTERVAL => simpler code
-#ifndef ROTARY_ISR_SERVICE
-    unsigned long currentMillis = millis();
-    /*
-    if (currentMillis < lastButtonCheck) {
-        lastButtonCheck = 0;
-    }
-    */
+#ifdef ENC_EVENT_QUEUE_SIZE
+    queueRotation();
 #endif
+}
+
+TEMPLATE_TYPES
+void ClickEncoder<TEMPLATE_TYPE_NAMES>::serviceButton() {
+#ifndef WITHOUT_BUTTON
     // check buttonState only, if a pin has been provided
     if (pinBTN >= 0) {
-
-#ifndef ROTARY_ISR_SERVICE
-        // Handle case when millis() wraps back around to zero
-        // checking buttonState is sufficient every 10-30ms
-        if ((unsigned long)(currentMillis - lastButtonCheck) >= ENC_BUTTONINTERVAL) {
-            lastButtonCheck = currentMillis;
+#ifdef BUTTON_ISR_SERVICE
+        // Edges are handled by serviceButtonEdge(), here we only need to handle the timeouts
+        advanceButton(millis());
+#else
+        serviceButtonTick(getPinState() == pinsActive);
 #endif
+    }
+#endif
+}
 
-            if (getPinState() == pinsActive) { // key is down
-                ++keyDownTicks;
-                if (buttonHeldEnabled && keyDownTicks > (buttonHoldTime / ENC_BUTTONINTERVAL)) {
-                    buttonState = Held;
-                }
-            } else {                    // key is now up
-                if (keyDownTicks > 1) { //Make sure key was down through 1 complete tick to prevent random transients from registering as click
-                    if (buttonState == Held) {
-                        buttonState = Released;
-                        doubleClickTicks = 0;
-                    } else {
-#define ENC_SINGLECLICKONLY 1
-                        if (doubleClickTicks > ENC_SINGLECLICKONLY) { // prevent trigger in single click mode
-                            if (doubleClickTicks < (buttonDoubleClickTime / ENC_BUTTONINTERVAL)) {
-                                buttonState = DoubleClicked;
-                                doubleClickTicks = 0;
-                            }
-                        } else {
-                            doubleClickTicks = (doubleClickEnabled) ? (buttonDoubleClickTime / ENC_BUTTONINTERVAL) : ENC_SINGLECLICKONLY;
-                        }
-                    }
-                }
-
-                keyDownTicks = 0;
-            }
-
-            if (doubleClickTicks > 0) {
-                --doubleClickTicks;
-                if (doubleClickTicks == 0) {
-                    buttonState = Clicked;
-                }
-            }
-#ifndef ROTARY_ISR_SERVICE
-        }
+TEMPLATE_TYPES
+void ClickEncoder<TEMPLATE_TYPE_NAMES>::prepareButton() {
+#ifndef WITHOUT_BUTTON
+    if (analogInput && pinBTN >= 0) {
+        AsyncAnalogRead<pinBTN, ClickEncoder>::start();
+    }
 #endif
+}
+
+TEMPLATE_TYPES
+void ClickEncoder<TEMPLATE_TYPE_NAMES>::pollButton() {
+#ifndef WITHOUT_BUTTON
+    if (analogInput && pinBTN >= 0) {
+        AsyncAnalogRead<pinBTN, ClickEncoder>::poll();
     }
-#endif // WITHOUT_BUTTON
+#endif
 }
 
 // ----------------------------------------------------------------------------
 TEMPLATE_TYPES
-int16_t ClickEncoder<TEMPLATE_TYPE_NAMES>::getValue() {
+int16_t ClickEncoder<TEMPLATE_TYPE_NAMES>::getAcceleration() {
 
     int16_t accel = 1;
 
-    if (accelerationEnabled) {
+    if (settings.accelerationEnabled) {
+
+#if defined(ROTARY_ACCEL_TIMESTAMPS)
+        uint16_t currentAccel;
+        accelTick_t lastUpdate;
+        // Interrupt safe multibyte read
+        do {
+            currentAccel = rotary.acceleration;
+            lastUpdate = rotary.accelerationUpdate;
+        } while (currentAccel != rotary.acceleration || lastUpdate != rotary.accelerationUpdate);
 
-#ifndef ROTARY_ACCEL_OPTIMIZATION
+        accel += (decayedAcceleration(currentAccel, (accelTick_t)(millis() - lastUpdate)) >> 8);
+#elif !defined(ROTARY_ACCEL_OPTIMIZATION)
         uint16_t currentAccel;
         // Interrupt safe multibyte read
         do {
-            currentAccel = acceleration;
-        } while (currentAccel != acceleration);
+            currentAccel = rotary.acceleration;
+        } while (currentAccel != rotary.acceleration);
 
         accel += (currentAccel >> 8);
 #else
-        int16_t accelChange = accelInc * ENC_ACCEL_INC - accelDec * ENC_ACCEL_DEC;
-        acceleration += accelChange;
+#if defined(BUTTON_ISR_SERVICE) && !defined(ENC_EVENT_QUEUE_SIZE)
+        // service() folds the counters as well
+        EncoderInterruptLock lock;
+#endif
+        foldAcceleration();
+        accel += (acceleration >> 8);
+#endif
+    }
 
-        if (acceleration > ENC_ACCEL_TOP) {
-            acceleration = accelChange < 0 ? 0 : ENC_ACCEL_TOP;
-        }
+    return accel;
+}
 
-        // Reset acceleration change counters
-        accelDec = 0;
-        accelInc = 0;
+TEMPLATE_TYPES
+int32_t ClickEncoder<TEMPLATE_TYPE_NAMES>::getPendingSteps() {
+    // With ENC_EVENT_QUEUE_SIZE only read by queueRotation(), from the service routine which also writes consumed
+    position_t _delta;
+    // Interrupt safe multibyte read
+    do {
+        _delta = rotary.delta;
+    } while (_delta != rotary.delta);
+
+    // The difference stays correct across overflows of the free running counter,
+    // it is taken modulo the width of consumed
+    return (consumed_t)((uint32_t)_delta - (uint32_t)consumed);
+}
 
-        accel += (acceleration >> 8);
+TEMPLATE_TYPES
+int16_t ClickEncoder<TEMPLATE_TYPE_NAMES>::getValue() {
+#ifdef ENC_EVENT_QUEUE_SIZE
+    // Depends on the template parameters, so that only a call fails to compile
+    static_assert(sizeof(Decoder) == 0, "With ENC_EVENT_QUEUE_SIZE the service routines consume the rotation, use getEvent() instead!");
+#endif
+    int8_t consumedSteps;
+    int16_t accel = getAcceleration();
+    int16_t value = EncoderNotches<stepsPerNotch>::value(getPendingSteps(), accel, consumedSteps);
+    consumed += consumedSteps;
+    return value;
+}
+
+TEMPLATE_TYPES
+int32_t ClickEncoder<TEMPLATE_TYPE_NAMES>::getValueBatch() {
+#ifdef ENC_EVENT_QUEUE_SIZE
+    // Depends on the template parameters, so that only a call fails to compile
+    static_assert(sizeof(Decoder) == 0, "With ENC_EVENT_QUEUE_SIZE the service routines consume the rotation, use getEvent() instead!");
 #endif
+    int32_t consumedSteps;
+    int16_t accel = getAcceleration();
+    int32_t value = EncoderNotches<stepsPerNotch>::batch(getPendingSteps(), accel, consumedSteps);
+    consumed += consumedSteps;
+    return value;
+}
+
+TEMPLATE_TYPES
+int32_t ClickEncoder<TEMPLATE_TYPE_NAMES>::getPosition() {
+    position_t position;
+    // Interrupt safe multibyte read
+    do {
+        position = rotary.delta;
+    } while (position != rotary.delta);
+
+    return EncoderNotches<stepsPerNotch>::position(position);
+}
+
+// ----------------------------------------------------------------------------
+
+#ifdef ENC_EVENT_QUEUE_SIZE
+TEMPLATE_TYPES
+bool ClickEncoder<TEMPLATE_TYPE_NAMES>::flushRotation() {
+    int32_t _pendingNotches = pendingNotches;
+    bool flushed = true;
+    while (_pendingNotches != 0) {
+        int16_t notches = _pendingNotches > INT16_MAX ? INT16_MAX : _pendingNotches < -INT16_MAX ? -INT16_MAX : (int16_t)_pendingNotches;
+        if (!events.push(EncoderRotated, notches, pendingTimestamp)) {
+            flushed = false;
+            break;
+        }
+        _pendingNotches -= notches;
     }
+    pendingNotches = _pendingNotches;
+    return flushed;
+}
+
+TEMPLATE_TYPES
+void ClickEncoder<TEMPLATE_TYPE_NAMES>::queueRotation() {
+    // Division truncates towards zero, so the remaining steps keep their sign
+    int16_t notches = (int16_t)(getPendingSteps() / (int16_t)stepsPerNotch);
+
+#ifdef ROTARY_ACCEL_OPTIMIZATION
+    // The 8 bit acceleration change counters wrap after 256 ticks, so they are folded on every call,
+    // not only when notches are pending
+    int16_t accel = getAcceleration();
+#endif
 
-    // Reads of one byte values is fine when interrupts are enabled (needs only one cycle)
-    int8_t val = delta;
+    if (notches != 0) {
+        consumed += notches * stepsPerNotch;
 
-    int8_t deltaChange = stepsPerNotch;
-    // We need some special treatment for negative values see: https://github.com/soligen2010/encoder/issues/14
-    if (val < 0) {
-        val = -val;
-        accel = -accel;
-        deltaChange = -deltaChange;
+        // Notches are accumulated while the queue is full, so no rotation gets lost
+        if (pendingNotches == 0) {
+            pendingTimestamp = (uint16_t)millis();
+        }
+#ifdef ROTARY_ACCEL_OPTIMIZATION
+        pendingNotches += (int32_t)notches * accel;
+#else
+        pendingNotches += (int32_t)notches * getAcceleration();
+#endif
     }
 
-    // Check if we have enough steps for a notch
-    if (val >= stepsPerNotch) {
+    flushRotation();
+}
 
-        // Apply delta changes
-        // Because we do not use modulo here this might cause "ghost moves" if not processed fast enough
-        // or you simply set the wrong value for stepsPerNotch
-        delta -= deltaChange;
+TEMPLATE_TYPES
+bool ClickEncoder<TEMPLATE_TYPE_NAMES>::getEvent(EncoderEvent &event) {
+    return events.pop(event);
+}
 
-        return accel;
+TEMPLATE_TYPES
+uint8_t ClickEncoder<TEMPLATE_TYPE_NAMES>::getEvents(EncoderEvent *eventBuffer, uint8_t maxEvents) {
+    uint8_t count = 0;
+    while (count < maxEvents && events.pop(eventBuffer[count])) {
+        ++count;
     }
+    return count;
+}
 
-    return 0;
+TEMPLATE_TYPES
+bool ClickEncoder<TEMPLATE_TYPE_NAMES>::getEventQueueOverflow() {
+    bool ret = eventQueueOverflow;
+    if (ret) {
+        // Reads & writes of one byte values is fine when interrupts are enabled (needs only one cycle)
+        eventQueueOverflow = false;
+    }
+    return ret;
 }
+#endif
 
 // ----------------------------------------------------------------------------
 
+#ifdef ENC_STATISTICS
+TEMPLATE_TYPES
+void ClickEncoder<TEMPLATE_TYPE_NAMES>::getStatistics(EncoderStatistics &stats) {
+    // Interrupt safe multibyte read, the barriers force a fresh copy of the counters on every try
+    do {
+        __asm__ __volatile__("" ::: "memory");
+        stats = statistics;
+        __asm__ __volatile__("" ::: "memory");
+    } while (!(stats == statistics));
+}
+
+// ----------------------------------------------------------------------------
+#endif
+
 #ifndef WITHOUT_BUTTON
+TEMPLATE_TYPES
+void ClickEncoder<TEMPLATE_TYPE_NAMES>::setButtonState(ButtonState state) {
+#if defined(ENC_STATISTICS) && !defined(ENC_EVENT_QUEUE_SIZE)
+    // Held is not consumed by getButtonState(), so only the other states can get lost.
+    // With the event queue the application consumes the events, only a full queue loses them.
+    if (buttonState != Open && buttonState != Held) {
+        ++statistics.droppedButtonEvents;
+    }
+#endif
+    buttonState = state;
+#ifdef ENC_EVENT_QUEUE_SIZE
+    // Queue pending rotation first to keep the order of the events
+    if (!flushRotation() || !events.push(state, 0, (uint16_t)millis())) {
+        eventQueueOverflow = true;
+#ifdef ENC_STATISTICS
+        ++statistics.droppedButtonEvents;
+#endif
+    }
+#endif
+}
+
+// One button check, which is done every ENC_BUTTONINTERVAL
+TEMPLATE_TYPES
+void ClickEncoder<TEMPLATE_TYPE_NAMES>::serviceButtonTick(bool keyDown) {
+    // The counters might be bitfields, which can not be passed by reference
+    uint16_t keyDownTicks = button.keyDownTicks;
+    uint16_t doubleClickTicks = button.doubleClickTicks;
+
+    ButtonStateMachine<ENC_BUTTONINTERVAL, buttonHoldTime, buttonDoubleClickTime, keyDownTicksLimit>::tick(
+        keyDown, keyDownTicks, doubleClickTicks, (ButtonState)buttonState, settings.buttonHeldEnabled, settings.doubleClickEnabled,
+        [](ButtonState state) { setButtonState(state); });
+
+    button.keyDownTicks = keyDownTicks;
+    button.doubleClickTicks = doubleClickTicks;
+}
+
+#ifdef BUTTON_ISR_SERVICE
+// The edge driven button emulates the periodic button checks: as the pin state is known between two edges,
+// we only have to run serviceButtonTick() for the ticks in which the button state might change.
+// All other ticks only count keyDownTicks & doubleClickTicks and can be skipped at once.
+
+// Number of upcoming button ticks which do not change the button state
+TEMPLATE_TYPES
+unsigned long ClickEncoder<TEMPLATE_TYPE_NAMES>::idleButtonTicks(bool keyDown, uint16_t _keyDownTicks, uint16_t _doubleClickTicks) {
+    const uint16_t holdTicks = buttonHoldTime / ENC_BUTTONINTERVAL;
+    unsigned long idle = (unsigned long)-1;
+
+    if (keyDown) {
+        if (settings.buttonHeldEnabled) {
+            if (_keyDownTicks <= holdTicks) {
+                idle = holdTicks - _keyDownTicks;
+            } else if (buttonState != Held) {
+                // Held gets reported again, i.e. after a click timed out while the button is held
+                idle = 0;
+            }
+        }
+#ifdef ENC_COMPACT_STATE
+        else if (_keyDownTicks < keyDownTicksLimit) {
+            // The 16 bit buttonTickMillis can not count the ticks of an arbitrarily long press,
+            // so service() has to run until keyDownTicks saturates
+            idle = keyDownTicksLimit - 1 - _keyDownTicks;
+        }
+#endif
+    } else if (_keyDownTicks > 0) {
+        // Release has to be handled by the next tick
+        idle = 0;
+    }
+
+    if (_doubleClickTicks > 0 && (unsigned long)(_doubleClickTicks - 1) < idle) {
+        idle = _doubleClickTicks - 1;
+    }
+
+    return idle;
+}
+
+// Runs all button ticks up to now, expects the pin state to be unchanged since the last call
+TEMPLATE_TYPES
+void ClickEncoder<TEMPLATE_TYPE_NAMES>::advanceButton(unsigned long now) {
+    // Handles millis() overflows, as only the difference is used
+    unsigned long ticks = (buttonTick_t)(now - buttonTickMillis) / ENC_BUTTONINTERVAL;
+    buttonTickMillis += ticks * ENC_BUTTONINTERVAL;
+
+    bool keyDown = button.pinActive;
+
+    while (ticks > 0) {
+        unsigned long idle = idleButtonTicks(keyDown, button.keyDownTicks, button.doubleClickTicks);
+        if (idle > ticks) {
+            idle = ticks;
+        }
+
+        if (keyDown) {
+            unsigned long increasedTicks = button.keyDownTicks + idle;
+            button.keyDownTicks = increasedTicks < keyDownTicksLimit ? increasedTicks : keyDownTicksLimit;
+        }
+        if (button.doubleClickTicks > 0) {
+            button.doubleClickTicks -= idle;
+        }
+        ticks -= idle;
+
+        if (ticks > 0) {
+            serviceButtonTick(keyDown);
+            --ticks;
+        }
+    }
+}
+
+TEMPLATE_TYPES
+bool ClickEncoder<TEMPLATE_TYPE_NAMES>::serviceButtonEdge() {
+    bool keyDown = getPinState() == pinsActive;
+
+    // Validate if there really was a toggle and this was not called due to jitter
+    if (keyDown != button.pinActive) {
+        // All ticks before now still saw the previous pin state, a tick at now sees the new one,
+        // like a button check right after the edge. Unless service() already ran that tick.
+        unsigned long now = millis();
+        if ((buttonTick_t)now != buttonTickMillis) {
+            advanceButton(now - 1);
+        }
+        button.pinActive = keyDown;
+        return true;
+    }
+    return false;
+}
+
+TEMPLATE_TYPES
+bool ClickEncoder<TEMPLATE_TYPE_NAMES>::nextButtonDeadline(unsigned long &deadline) {
+    bool keyDown;
+    uint16_t _keyDownTicks;
+    uint16_t _doubleClickTicks;
+    buttonTick_t tickMillis;
+    // Interrupt safe multibyte read, the button ticks are only changed from within service routines
+    do {
+        keyDown = button.pinActive;
+        _keyDownTicks = button.keyDownTicks;
+        _doubleClickTicks = button.doubleClickTicks;
+        tickMillis = buttonTickMillis;
+    } while (tickMillis != buttonTickMillis || keyDown != button.pinActive || _keyDownTicks != button.keyDownTicks || _doubleClickTicks != button.doubleClickTicks);
+
+    unsigned long idle = idleButtonTicks(keyDown, _keyDownTicks, _doubleClickTicks);
+    unsigned long now = millis();
+    bool due = false;
+    if (idle != (unsigned long)-1) {
+        // buttonTickMillis might only hold the low bits of millis()
+        deadline = now - (buttonTick_t)(now - tickMillis) + (idle + 1) * ENC_BUTTONINTERVAL;
+        due = true;
+    }
+
+    unsigned long accelDeadline;
+    if (accelerationDeadline(now, accelDeadline) && (!due || (long)(accelDeadline - deadline) < 0)) {
+        deadline = accelDeadline;
+        due = true;
+    }
+
+#ifdef ENC_EVENT_QUEUE_SIZE
+    int32_t _pendingNotches;
+    // Interrupt safe multibyte read
+    do {
+        _pendingNotches = pendingNotches;
+    } while (_pendingNotches != pendingNotches);
+
+    // Rotation waits for space in the queue, which only service() & the next step try again
+    if (_pendingNotches) {
+        deadline = now;
+        due = true;
+    }
+#endif
+    return due;
+}
+
+// Returns if service() is needed for the acceleration, and when
+TEMPLATE_TYPES
+bool ClickEncoder<TEMPLATE_TYPE_NAMES>::accelerationDeadline(unsigned long now, unsigned long &deadline) {
+    if (!settings.accelerationEnabled) {
+        return false;
+    }
+
+#if defined(ROTARY_ACCEL_TIMESTAMPS)
+#ifdef ENC_COMPACT_STATE
+    // The 16 bit timestamp of the last step must not wrap around before the acceleration decayed to 0,
+    // which decAcceleration() records ENC_ACCEL_TOP ms after the last step
+    uint16_t currentAccel;
+    accelTick_t lastUpdate;
+    // Interrupt safe multibyte read
+    do {
+        currentAccel = rotary.acceleration;
+        lastUpdate = rotary.accelerationUpdate;
+    } while (currentAccel != rotary.acceleration || lastUpdate != rotary.accelerationUpdate);
+
+    if (ENC_ACCEL_DEC && currentAccel) {
+        deadline = now - (accelTick_t)(now - lastUpdate) + ENC_ACCEL_TOP + 1;
+        return true;
+    }
+#else
+    // Derived from the timestamps, nothing to do
+    (void)now;
+    (void)deadline;
+#endif
+    return false;
+#else
+    // The acceleration only decays with every service() call, which therefore has to continue every 1ms until it reached 0.
+    // A deceleration more than 255 ms ago might delay the next one by 1 ms.
+#ifdef ROTARY_ACCEL_OPTIMIZATION
+    // Folded by every service() call, pending increments still have to decay
+    uint16_t currentAccel;
+    {
+        EncoderInterruptLock lock;
+        currentAccel = acceleration;
+    }
+    bool decaying = ENC_ACCEL_DEC && (currentAccel || rotary.accelInc);
+#else
+    uint16_t currentAccel;
+    // Interrupt safe multibyte read
+    do {
+        currentAccel = rotary.acceleration;
+    } while (currentAccel != rotary.acceleration);
+
+    bool decaying = ENC_ACCEL_DEC && currentAccel;
+#endif
+    deadline = now - (uint8_t)(now - lastDecAcceleration) + 1;
+    return decaying;
+#endif
+}
+#endif
+
 TEMPLATE_TYPES
 ButtonState ClickEncoder<TEMPLATE_TYPE_NAMES>::getButtonState() {
-    ButtonState ret = buttonState;
+    ButtonState ret = (ButtonState)buttonState;
     if (ret != Held) {
         // Reads & writes of one byte values is fine when interrupts are enabled (needs only one cycle)
         buttonState = Open; // reset
@@ -350,7 +1028,8 @@ TEMPLATE_TYPES
 bool ClickEncoder<TEMPLATE_TYPE_NAMES>::getPinState() {
     bool pinState;
     if (analogInput) {
-        int16_t pinValue = FastPin<pinBTN>::analogRead();
+        // Collect the conversion requested by prepareButton(), we never wait for the ADC
+        int16_t pinValue = AsyncAnalogRead<pinBTN, ClickEncoder>::check();
         pinState = ((pinValue >= anlogActiveRangeLow) && (pinValue <= anlogActiveRangeHigh)) ? pinsActive : !pinsActive; // set result to LOW (buttonState pressed) if analog input is in range
     } else {
         pinState = FastPin<pinBTN>::digitalRead();
@@ -358,9 +1037,4 @@ bool ClickEncoder<TEMPLATE_TYPE_NAMES>::getPinState() {
     return pinState;
 }
 
-#if defined(ROTARY_ISR_SERVICE) && defined(SPLIT_ROTARY_ISR_SERVICE)
-#undef _LAST_PIN_A_STATE_MASK
-#undef _LAST_PIN_B_STATE_MASK
-#endif
-
 #endif
@@ -0,0 +1,248 @@
+// ----------------------------------------------------------------------------
+// Port-parallel Rotary Encoder Bank with Acceleration
+// Decodes all encoders wired to the same GPIO port with a single port read
+//
+// Timer-based rotary encoder logic by Peter Dannegger
+// http://www.mikrocontroller.net/articles/Drehgeber
+// ----------------------------------------------------------------------------
+
+#ifndef __have__ClickEncoderBank_h__
+#define __have__ClickEncoderBank_h__
+
+#include <stdint.h>
+#include <Arduino.h>
+
+#include "ClickEncoderNotches.h"
+
+// ----------------------------------------------------------------------------
+// Acceleration configuration (for 1000Hz calls to ::service()), same defaults as ClickEncoder
+//
+#define DEFAULT_ENC_ACCEL_TOP 3072 // max. acceleration: 12 encoded as maxAccel * pow(2, 8)
+#define DEFAULT_ENC_ACCEL_INC 25
+#define DEFAULT_ENC_ACCEL_DEC 2
+#define DEFAULT_STEPS_PER_NOTCH 4
+
+// ----------------------------------------------------------------------------
+// Wiring of one encoder: bit positions of pin A and pin B inside the port register
+template <uint8_t bitA, uint8_t bitB>
+struct EncoderChannel {
+    static const uint8_t pinA = bitA;
+    static const uint8_t pinB = bitB;
+};
+
+// List of all encoders wired to the port, the order defines the channel index
+template <typename... Channels>
+struct EncoderChannels;
+
+template <>
+struct EncoderChannels<> {
+    static const uint8_t count = 0;
+
+    static constexpr uint32_t maskA() {
+        return 0;
+    }
+
+    static constexpr uint32_t maskB() {
+        return 0;
+    }
+
+    static constexpr bool uniformOffset(int8_t /*offset*/) {
+        return true;
+    }
+
+    template <typename port_t>
+    static inline __attribute__((always_inline)) port_t gatherB(port_t /*active*/) {
+        return 0;
+    }
+
+    template <typename Bank, typename port_t>
+    static inline __attribute__((always_inline)) void dispatch(port_t /*up*/, port_t /*down*/, uint8_t /*channel*/) {}
+};
+
+template <typename Channel, typename... Rest>
+struct EncoderChannels<Channel, Rest...> {
+    typedef EncoderChannels<Rest...> Next;
+
+    static const uint8_t count = 1 + Next::count;
+
+    static constexpr uint32_t maskA() {
+        return (((uint32_t)1) << Channel::pinA) | Next::maskA();
+    }
+
+    static constexpr uint32_t maskB() {
+        return (((uint32_t)1) << Channel::pinB) | Next::maskB();
+    }
+
+    // Offset between pin B and pin A of the first channel, used to align all B bits with a single shift
+    static constexpr int8_t offset() {
+        return (int8_t)Channel::pinB - (int8_t)Channel::pinA;
+    }
+
+    static constexpr bool uniformOffset(int8_t offset) {
+        return ((int8_t)Channel::pinB - (int8_t)Channel::pinA) == offset && Next::uniformOffset(offset);
+    }
+
+    static constexpr bool disjoint() {
+        return ((((uint32_t)1) << Channel::pinA) & (Next::maskA() | Next::maskB())) == 0 &&
+               ((((uint32_t)1) << Channel::pinB) & (Next::maskA() | Next::maskB())) == 0;
+    }
+
+    // Move the B bits of all channels to the bit positions of their A bits (generic wiring)
+    template <typename port_t>
+    static inline __attribute__((always_inline)) port_t gatherB(port_t active) {
+        return (port_t)((((active >> Channel::pinB) & 1) << Channel::pinA) | Next::gatherB(active));
+    }
+
+    template <typename Bank, typename port_t>
+    static inline __attribute__((always_inline)) void dispatch(port_t up, port_t down, uint8_t channel) {
+        const port_t bit = ((port_t)1) << Channel::pinA;
+        if ((up | down) & bit) {
+            Bank::step(channel, (up & bit) ? 1 : -1);
+        }
+        Next::template dispatch<Bank>(up, down, channel + 1);
+    }
+};
+
+// ----------------------------------------------------------------------------
+// PortReader has to provide the port register type and a read function, i.e. for AVR:
+//
+//   struct PortD {
+//       typedef uint8_t port_t;
+//       static inline port_t read() { return PIND; }
+//   };
+//
+// The encoder pins have to be configured as inputs (with pullups if needed) by the application.
+template <typename PortReader,
+          typename Channels,
+          bool pinsActive = false,
+          uint8_t stepsPerNotch = DEFAULT_STEPS_PER_NOTCH,
+          uint16_t ENC_ACCEL_TOP = DEFAULT_ENC_ACCEL_TOP,
+          uint16_t ENC_ACCEL_INC = DEFAULT_ENC_ACCEL_INC,
+          uint16_t ENC_ACCEL_DEC = DEFAULT_ENC_ACCEL_DEC>
+class ClickEncoderBank {
+  public:
+    typedef typename PortReader::port_t port_t;
+
+    static const uint8_t channelCount = Channels::count;
+
+    static_assert(Channels::count > 0, "A ClickEncoderBank needs at least one encoder channel!");
+    static_assert(Channels::count <= 8 * sizeof(port_t), "More encoder channels than port bits!");
+    static_assert((Channels::maskA() | Channels::maskB()) <= (uint32_t)(port_t)~(port_t)0, "Encoder pin bit does not fit into the port type!");
+    static_assert(Channels::disjoint() && (Channels::maskA() & Channels::maskB()) == 0, "Encoder channels must not share port bits!");
+
+    static void init();
+
+    static inline void service() __attribute__((always_inline));
+
+#ifndef ROTARY_ISR_SERVICE
+  private:
+#endif
+    static inline bool rotaryService() __attribute__((always_inline));
+#ifndef ROTARY_ISR_SERVICE
+  public:
+#endif
+
+    // Consumes at most one notch. Only the low 16 bits of the consumed steps are kept: more than 32767 pending
+    // steps wrap around and are reported in the opposite direction, so consume at least every 32767 steps.
+    static int16_t getValue(uint8_t channel);
+
+    // Consumes all complete notches at once (remaining steps are kept) and applies the acceleration to the whole batch,
+    // with the same limit of 32767 pending steps as getValue()
+    static int32_t getValueBatch(uint8_t channel);
+
+    // Absolute position in notches (without acceleration), does not consume anything
+    static int32_t getPosition(uint8_t channel);
+
+    static inline void setAccelerationEnabled(uint8_t channel, bool a) {
+        const port_t bit = ((port_t)1) << channel;
+        if (a) {
+            accelerationEnabled |= bit;
+        } else {
+            accelerationEnabled &= (port_t)~bit;
+            acceleration[channel] = 0;
+        }
+    }
+
+    static inline bool getAccelerationEnabled(uint8_t channel) __attribute__((always_inline)) {
+        return accelerationEnabled & (((port_t)1) << channel);
+    }
+
+  private:
+    template <typename... C>
+    friend struct EncoderChannels;
+
+    static inline void step(uint8_t channel, int8_t dir) __attribute__((always_inline));
+    static inline uint16_t currentAcceleration(uint16_t accel, uint32_t lastUpdate, uint32_t now) __attribute__((always_inline));
+    static inline int16_t getAcceleration(uint8_t channel) __attribute__((always_inline));
+    static inline int32_t getPendingSteps(uint8_t channel) __attribute__((always_inline));
+    static inline int32_t getStepPosition(uint8_t channel) __attribute__((always_inline));
+
+    static const port_t maskA = (port_t)Channels::maskA();
+
+    static inline port_t alignB(port_t active) __attribute__((always_inline));
+
+  protected:
+    // Bit-sliced decoder state: bit 1 & bit 0 of the Peter Dannegger state of every channel,
+    // both stored at the bit position of the channels pin A
+    static volatile port_t last1;
+    static volatile port_t last0;
+
+    // Bit i = acceleration of channel i enabled
+    static port_t accelerationEnabled;
+
+    // Service tick counter, deceleration is applied lazily using the ticks since the last update
+    static volatile uint32_t ticks;
+
+    // Absolute step position per channel, only written by the service routines
+    static volatile int32_t delta[Channels::count];
+    // Steps that were already consumed (low 16 bits like ClickEncoder), only written by getValue() & getValueBatch()
+    static int16_t consumed[Channels::count];
+    static volatile uint16_t acceleration[Channels::count];
+    static volatile uint32_t accelerationTick[Channels::count];
+};
+
+#define BANK_TEMPLATE_TYPES template <typename PortReader,     \
+                                      typename Channels,       \
+                                      bool pinsActive,         \
+                                      uint8_t stepsPerNotch,   \
+                                      uint16_t ENC_ACCEL_TOP,  \
+                                      uint16_t ENC_ACCEL_INC,  \
+                                      uint16_t ENC_ACCEL_DEC>
+
+#define BANK_TEMPLATE_TYPE_NAMES PortReader,    \
+                                 Channels,      \
+                                 pinsActive,    \
+                                 stepsPerNotch, \
+                                 ENC_ACCEL_TOP, \
+                                 ENC_ACCEL_INC, \
+                                 ENC_ACCEL_DEC
+
+BANK_TEMPLATE_TYPES
+volatile typename ClickEncoderBank<BANK_TEMPLATE_TYPE_NAMES>::port_t ClickEncoderBank<BANK_TEMPLATE_TYPE_NAMES>::last1 = 0;
+BANK_TEMPLATE_TYPES
+volatile typename ClickEncoderBank<BANK_TEMPLATE_TYPE_NAMES>::port_t ClickEncoderBank<BANK_TEMPLATE_TYPE_NAMES>::last0 = 0;
+BANK_TEMPLATE_TYPES
+typename ClickEncoderBank<BANK_TEMPLATE_TYPE_NAMES>::port_t ClickEncoderBank<BANK_TEMPLATE_TYPE_NAMES>::accelerationEnabled = (typename ClickEncoderBank<BANK_TEMPLATE_TYPE_NAMES>::port_t)~0;
+BANK_TEMPLATE_TYPES
+volatile uint32_t ClickEncoderBank<BANK_TEMPLATE_TYPE_NAMES>::ticks = 0;
+BANK_TEMPLATE_TYPES
+volatile int32_t ClickEncoderBank<BANK_TEMPLATE_TYPE_NAMES>::delta[Channels::count] = {0};
+BANK_TEMPLATE_TYPES
+int16_t ClickEncoderBank<BANK_TEMPLATE_TYPE_NAMES>::consumed[Channels::count] = {0};
+BANK_TEMPLATE_TYPES
+volatile uint16_t ClickEncoderBank<BANK_TEMPLATE_TYPE_NAMES>::acceleration[Channels::count] = {0};
+BANK_TEMPLATE_TYPES
+volatile uint32_t ClickEncoderBank<BANK_TEMPLATE_TYPE_NAMES>::accelerationTick[Channels::count] = {0};
+
+// ----------------------------------------------------------------------------
+
+#include "ClickEncoderBank.tpp"
+
+#undef DEFAULT_ENC_ACCEL_TOP
+#undef DEFAULT_ENC_ACCEL_INC
+#undef DEFAULT_ENC_ACCEL_DEC
+#undef DEFAULT_STEPS_PER_NOTCH
+#undef BANK_TEMPLATE_TYPES
+#undef BANK_TEMPLATE_TYPE_NAMES
+
+#endif // __have__ClickEncoderBank_h__
@@ -0,0 +1,167 @@
+// ----------------------------------------------------------------------------
+// Port-parallel Rotary Encoder Bank with Acceleration
+// Decodes all encoders wired to the same GPIO port with a single port read
+//
+// Timer-based rotary encoder logic by Peter Dannegger
+// http://www.mikrocontroller.net/articles/Drehgeber
+// ----------------------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+BANK_TEMPLATE_TYPES
+void ClickEncoderBank<BANK_TEMPLATE_TYPE_NAMES>::init() {
+    port_t port = PortReader::read();
+    port_t active = pinsActive ? port : (port_t)~port;
+
+    // Same encoding as ClickEncoder: state = (A ? 3 : 0) ^ B
+    port_t curr1 = active & maskA;
+    last1 = curr1;
+    last0 = curr1 ^ alignB(active);
+}
+
+// ----------------------------------------------------------------------------
+
+BANK_TEMPLATE_TYPES
+typename ClickEncoderBank<BANK_TEMPLATE_TYPE_NAMES>::port_t ClickEncoderBank<BANK_TEMPLATE_TYPE_NAMES>::alignB(port_t active) {
+    const int8_t offset = Channels::offset();
+
+    if (Channels::uniformOffset(offset)) {
+        // All channels are wired the same way: a single shift moves every B bit next to its A bit
+        port_t aligned = offset >= 0 ? (port_t)(active >> (offset >= 0 ? offset : 0)) : (port_t)(active << (offset >= 0 ? 0 : -offset));
+        return aligned & maskA;
+    }
+
+    return Channels::gatherB(active);
+}
+
+BANK_TEMPLATE_TYPES
+uint16_t ClickEncoderBank<BANK_TEMPLATE_TYPE_NAMES>::currentAcceleration(uint16_t accel, uint32_t lastUpdate, uint32_t now) {
+    uint32_t elapsed = now - lastUpdate;
+
+    // Prevent an overflow of the multiplication, as we would have decelerated to 0 anyway
+    if (ENC_ACCEL_DEC && elapsed >= ENC_ACCEL_TOP) {
+        return 0;
+    }
+
+    uint32_t decrease = elapsed * ENC_ACCEL_DEC;
+    return decrease >= accel ? 0 : accel - decrease;
+}
+
+BANK_TEMPLATE_TYPES
+void ClickEncoderBank<BANK_TEMPLATE_TYPE_NAMES>::step(uint8_t channel, int8_t dir) {
+    delta[channel] += dir;
+
+    if (accelerationEnabled & (((port_t)1) << channel)) {
+        uint32_t now = ticks;
+        // Apply the deceleration of all ticks since the last update, then accelerate.
+        // This equals the per tick decAcceleration() & incAcceleration() of ClickEncoder
+        uint16_t increasedAcc = currentAcceleration(acceleration[channel], accelerationTick[channel], now) + ENC_ACCEL_INC;
+        acceleration[channel] = increasedAcc < ENC_ACCEL_TOP ? increasedAcc : ENC_ACCEL_TOP;
+        accelerationTick[channel] = now;
+    }
+}
+
+// We expect that interrupts will be disabled during executing this function inside a ISR
+BANK_TEMPLATE_TYPES
+bool ClickEncoderBank<BANK_TEMPLATE_TYPE_NAMES>::rotaryService() {
+    port_t port = PortReader::read();
+    port_t active = pinsActive ? port : (port_t)~port;
+
+    // Bit-sliced version of ClickEncoder::rotaryService() for all channels at once:
+    // curr = (A ? 3 : 0) ^ B, diff = last - curr, bit 0 of diff = step, bit 1 of diff = direction
+    port_t curr1 = active & maskA;
+    port_t curr0 = curr1 ^ alignB(active);
+
+    port_t _last1 = last1;
+    port_t _last0 = last0;
+
+    port_t detectedSteps = _last0 ^ curr0;
+
+    if (detectedSteps) {
+        // bit 1 of (last - curr) including the borrow of bit 0 => 1 means +1
+        port_t up = _last1 ^ curr1 ^ ((port_t)~_last0 & curr0);
+
+        // Illegal transitions (both pins toggled) keep their last state, like in ClickEncoder.
+        // Bit 0 only differs for channels with a detected step, therefore it can be taken over as is
+        last1 = (_last1 & (port_t)~detectedSteps) | (curr1 & detectedSteps);
+        last0 = curr0;
+
+        Channels::template dispatch<ClickEncoderBank>((port_t)(detectedSteps & up), (port_t)(detectedSteps & (port_t)~up), 0);
+    }
+
+    return detectedSteps;
+}
+
+// This function still needs to be polled, as it provides the time base of the deceleration
+BANK_TEMPLATE_TYPES
+void ClickEncoderBank<BANK_TEMPLATE_TYPE_NAMES>::service() {
+    ++ticks;
+
+#ifndef ROTARY_ISR_SERVICE
+    rotaryService();
+#endif
+}
+
+// ----------------------------------------------------------------------------
+BANK_TEMPLATE_TYPES
+int16_t ClickEncoderBank<BANK_TEMPLATE_TYPE_NAMES>::getAcceleration(uint8_t channel) {
+
+    int16_t accel = 1;
+
+    if (accelerationEnabled & (((port_t)1) << channel)) {
+        uint32_t now;
+        uint16_t currentAccel;
+        uint32_t lastUpdate;
+        // Interrupt safe multibyte read: service() changes ticks, a step (i.e. from a pin change ISR) the acceleration fields
+        do {
+            now = ticks;
+            currentAccel = acceleration[channel];
+            lastUpdate = accelerationTick[channel];
+        } while (now != ticks || currentAccel != acceleration[channel] || lastUpdate != accelerationTick[channel]);
+
+        accel += (currentAcceleration(currentAccel, lastUpdate, now) >> 8);
+    }
+
+    return accel;
+}
+
+BANK_TEMPLATE_TYPES
+int32_t ClickEncoderBank<BANK_TEMPLATE_TYPE_NAMES>::getStepPosition(uint8_t channel) {
+    int32_t position;
+    // Interrupt safe multibyte read
+    do {
+        position = delta[channel];
+    } while (position != delta[channel]);
+
+    return position;
+}
+
+BANK_TEMPLATE_TYPES
+int32_t ClickEncoderBank<BANK_TEMPLATE_TYPE_NAMES>::getPendingSteps(uint8_t channel) {
+    // The difference stays correct across overflows of the free running counter,
+    // it is taken modulo the width of consumed
+    return (int16_t)((uint32_t)getStepPosition(channel) - (uint32_t)consumed[channel]);
+}
+
+BANK_TEMPLATE_TYPES
+int16_t ClickEncoderBank<BANK_TEMPLATE_TYPE_NAMES>::getValue(uint8_t channel) {
+    // Same notches as ClickEncoder
+    int8_t consumedSteps;
+    int16_t accel = getAcceleration(channel);
+    int16_t value = EncoderNotches<stepsPerNotch>::value(getPendingSteps(channel), accel, consumedSteps);
+    consumed[channel] += consumedSteps;
+    return value;
+}
+
+BANK_TEMPLATE_TYPES
+int32_t ClickEncoderBank<BANK_TEMPLATE_TYPE_NAMES>::getValueBatch(uint8_t channel) {
+    int32_t consumedSteps;
+    int16_t accel = getAcceleration(channel);
+    int32_t value = EncoderNotches<stepsPerNotch>::batch(getPendingSteps(channel), accel, consumedSteps);
+    consumed[channel] += consumedSteps;
+    return value;
+}
+
+BANK_TEMPLATE_TYPES
+int32_t ClickEncoderBank<BANK_TEMPLATE_TYPE_NAMES>::getPosition(uint8_t channel) {
+    return EncoderNotches<stepsPerNotch>::position(getStepPosition(channel));
+}
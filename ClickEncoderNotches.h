@@ -0,0 +1,67 @@
+// ----------------------------------------------------------------------------
+// Notch arithmetic of the step counters
+// Shared by ClickEncoder & ClickEncoderBank, so that both report the same values
+// ----------------------------------------------------------------------------
+
+#ifndef __have__ClickEncoderNotches_h__
+#define __have__ClickEncoderNotches_h__
+
+#include <stdint.h>
+
+// pendingSteps are the steps which were not consumed yet, accel the current acceleration (at least 1).
+// Every function which consumes steps passes them in consumedSteps, to be added to the consumed steps by the caller.
+template <uint8_t stepsPerNotch>
+struct EncoderNotches {
+    // At most a single notch, in the direction of the pending steps
+    static inline int16_t value(int32_t pendingSteps, int16_t accel, int8_t &consumedSteps) __attribute__((always_inline));
+    // All complete notches at once, the remaining steps are kept
+    static inline int32_t batch(int32_t pendingSteps, int16_t accel, int32_t &consumedSteps) __attribute__((always_inline));
+    // Notch of the absolute step position
+    static inline int32_t position(int32_t steps) __attribute__((always_inline));
+};
+
+template <uint8_t stepsPerNotch>
+int16_t EncoderNotches<stepsPerNotch>::value(int32_t pendingSteps, int16_t accel, int8_t &consumedSteps) {
+    int8_t deltaChange = stepsPerNotch;
+    // We need some special treatment for negative values see: https://github.com/soligen2010/encoder/issues/14
+    if (pendingSteps < 0) {
+        pendingSteps = -pendingSteps;
+        accel = -accel;
+        deltaChange = -deltaChange;
+    }
+
+    // Check if we have enough steps for a notch
+    if (pendingSteps >= stepsPerNotch) {
+
+        // Consume only a single notch
+        // Because we do not use modulo here this might cause "ghost moves" if not processed fast enough
+        // or you simply set the wrong value for stepsPerNotch, use getValueBatch() to avoid them
+        consumedSteps = deltaChange;
+
+        return accel;
+    }
+
+    consumedSteps = 0;
+    return 0;
+}
+
+template <uint8_t stepsPerNotch>
+int32_t EncoderNotches<stepsPerNotch>::batch(int32_t pendingSteps, int16_t accel, int32_t &consumedSteps) {
+    // Division truncates towards zero, so the remaining steps keep their sign
+    int32_t notches = pendingSteps / (int16_t)stepsPerNotch;
+
+    consumedSteps = notches * stepsPerNotch;
+
+    return notches * accel;
+}
+
+template <uint8_t stepsPerNotch>
+int32_t EncoderNotches<stepsPerNotch>::position(int32_t steps) {
+    // Round towards negative infinity, so that every notch has the same width
+    if (steps < 0) {
+        steps -= stepsPerNotch - 1;
+    }
+    return steps / stepsPerNotch;
+}
+
+#endif // __have__ClickEncoderNotches_h__
@@ -0,0 +1,114 @@
+// ----------------------------------------------------------------------------
+// Static scheduler for several ClickEncoder instantiations
+// Services all encoders from a single timer ISR without calling millis()
+//
+// Rotary decoding & acceleration of every member run at the service rate,
+// the button of every member is checked every ENC_BUTTONINTERVAL calls.
+// The button checks of the members are staggered across the ticks, so that
+// they are not all due within the same call.
+// ----------------------------------------------------------------------------
+
+#ifndef __have__ClickEncoderSet_h__
+#define __have__ClickEncoderSet_h__
+
+#include <ClickEncoder.h>
+
+// ----------------------------------------------------------------------------
+// Least common multiple of two button intervals
+static constexpr uint32_t encoderSetGcd(uint32_t a, uint32_t b) {
+    return b ? encoderSetGcd(b, a % b) : a;
+}
+
+static constexpr uint32_t encoderSetLcm(uint32_t a, uint32_t b) {
+    return a / encoderSetGcd(a, b) * b;
+}
+
+// ----------------------------------------------------------------------------
+// List of the members, the order defines the index
+template <typename... Encoders>
+struct ClickEncoderSetMembers;
+
+template <>
+struct ClickEncoderSetMembers<> {
+    static const uint8_t count = 0;
+    static const uint32_t period = 1;
+
+    static inline void init() {}
+
+    static inline __attribute__((always_inline)) void serviceEncoders() {}
+
+    static inline __attribute__((always_inline)) void serviceButtons(uint16_t /*tick*/) {}
+};
+
+template <typename Encoder, typename... Rest>
+struct ClickEncoderSetMembers<Encoder, Rest...> {
+    typedef ClickEncoderSetMembers<Rest...> Next;
+
+    static const uint8_t count = 1 + Next::count;
+    // The shared tick counter wraps around after a multiple of every button interval
+    static const uint32_t period = Encoder::buttonInterval ? encoderSetLcm(Encoder::buttonInterval, Next::period) : Next::period;
+
+    static inline void init() {
+        Encoder::init();
+        Next::init();
+    }
+
+    static inline __attribute__((always_inline)) void serviceEncoders() {
+        Encoder::serviceEncoder();
+        Next::serviceEncoders();
+    }
+
+    // tick is the shared tick counter plus the index of the member, so the button of member i is checked
+    // when (tick + i) % buttonInterval == 0. The modulo of a power of two interval (the default 32) is a mask.
+    // An analog button gets its ADC conversion requested one tick before the check, in between the
+    // conversions are polled.
+    static inline __attribute__((always_inline)) void serviceButtons(uint16_t tick) {
+        if (Encoder::buttonInterval) {
+            uint8_t phase = tick % Encoder::buttonInterval;
+            if (phase == 0) {
+                Encoder::serviceButton();
+            } else if (phase == Encoder::buttonInterval - 1) {
+                Encoder::prepareButton();
+            } else {
+                Encoder::pollButton();
+            }
+        }
+        Next::serviceButtons(tick + 1);
+    }
+};
+
+// ----------------------------------------------------------------------------
+// ClickEncoderSet<Encoder1, Encoder2, ...>::service() replaces the service() calls of all members
+// and has to be called every millisecond (or at the rate ENC_ACCEL_DEC is configured for).
+template <typename... Encoders>
+class ClickEncoderSet {
+  public:
+    typedef ClickEncoderSetMembers<Encoders...> Members;
+
+    static const uint8_t memberCount = Members::count;
+
+    static_assert(Members::count > 0, "A ClickEncoderSet needs at least one encoder!");
+    static_assert(Members::period + Members::count <= 0xFFFF, "The button intervals of the members have no common multiple below 65536!");
+
+    static inline void init() {
+        Members::init();
+        tick = 0;
+    }
+
+    static inline void service() __attribute__((always_inline)) {
+        Members::serviceEncoders();
+        if (++tick == Members::period) {
+            tick = 0;
+        }
+        Members::serviceButtons(tick);
+    }
+
+  protected:
+    // Shared by all members, counts the service() calls modulo Members::period
+    static uint16_t tick;
+};
+
+template <typename... Encoders>
+uint16_t ClickEncoderSet<Encoders...>::tick = 0;
+
+#endif // __have__ClickEncoderSet_h__
@@ -0,0 +1,205 @@
+// ----------------------------------------------------------------------------
+// Shared parts of the host benchmarks: command line options, the timing loop
+// and compile time lists of N encoders (or buttons) built from an index.
+// ----------------------------------------------------------------------------
+
+#ifndef __have__BenchCommon_h__
+#define __have__BenchCommon_h__
+
+#include <ClickEncoder.h>
+
+#include "PerfCounter.h"
+
+#include <chrono>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ---Options---------------------------------------------------------------------
+
+// Every benchmark accepts all options, so that the bench target can pass a common BENCH_ARGS.
+// Options without meaning for a benchmark are ignored.
+struct BenchOptions {
+    double rpm = 120.0;
+    uint8_t bounce = 0;
+    double jitter = 0.0;
+    uint32_t ticks = 1u << 18;
+    uint32_t repeats = 7;
+    uint32_t tickMicros = 1000;
+    uint8_t spinning = 1; // encoders turned at the same time
+    uint32_t seed = 1;    // random button presses
+};
+
+static inline void parseOptions(int argc, char **argv, BenchOptions &opts) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "--rpm")) {
+            opts.rpm = atof(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--bounce")) {
+            opts.bounce = (uint8_t)atoi(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--jitter")) {
+            opts.jitter = atof(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--ticks")) {
+            opts.ticks = (uint32_t)atol(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--repeats")) {
+            opts.repeats = (uint32_t)atol(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--tick-micros")) {
+            opts.tickMicros = (uint32_t)atol(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--spinning")) {
+            opts.spinning = (uint8_t)atoi(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--seed")) {
+            opts.seed = (uint32_t)atol(argv[i + 1]);
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            exit(1);
+        }
+    }
+    if (opts.ticks == 0 || opts.repeats == 0 || opts.tickMicros == 0) {
+        fprintf(stderr, "--ticks, --repeats and --tick-micros must be > 0\n");
+        exit(1);
+    }
+}
+
+// ---Timing----------------------------------------------------------------------
+
+struct Result {
+    double ns;
+    double instructions;
+};
+
+// Runs setup(), then replay(i) & body() for every tick i of the trace, keeps the fastest repetition
+template <typename Setup, typename Replay, typename Body>
+static Result measure(size_t ticks, const BenchOptions &opts, Setup setup, Replay replay, Body body) {
+    PerfCounter counter;
+    Result best = {1e300, 1e300};
+
+    for (uint32_t r = 0; r < opts.repeats; ++r) {
+        setup();
+
+        counter.start();
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < ticks; ++i) {
+            replay(i);
+            body();
+        }
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        uint64_t instructions = counter.stop();
+
+        double ns = std::chrono::duration<double, std::nano>(end - begin).count() / ticks;
+        double instr = counter.available() ? (double)instructions / ticks : -1.0;
+        if (ns < best.ns) {
+            best.ns = ns;
+        }
+        if (instr < best.instructions) {
+            best.instructions = instr;
+        }
+    }
+    return best;
+}
+
+template <typename Replay, typename Body>
+static Result measure(size_t ticks, const BenchOptions &opts, Replay replay, Body body) {
+    return measure(ticks, opts, []() {}, replay, body);
+}
+
+// Prints the cost of result above the baseline (i.e. an empty body), per call or per tick
+static inline void printCost(const Result &result, const Result &baseline, const char *per) {
+    double ns = result.ns - baseline.ns;
+    printf(" %9.2f ns/%s", ns < 0.0 ? 0.0 : ns, per);
+    if (result.instructions >= 0.0) {
+        printf(" %9.1f instr/%s\n", result.instructions - baseline.instructions, per);
+    } else {
+        printf(" %9s instr/%s\n", "n/a", per);
+    }
+}
+
+// ---Compile time lists of N encoders--------------------------------------------
+
+// MakeList<Element, List, N>::type is List<Element<0>::type, ..., Element<N - 1>::type>
+template <template <uint8_t> class Element, template <typename...> class List, uint8_t N, typename... Elements>
+struct MakeList {
+    typedef typename MakeList<Element, List, N - 1, typename Element<N - 1>::type, Elements...>::type type;
+};
+
+template <template <uint8_t> class Element, template <typename...> class List, typename... Elements>
+struct MakeList<Element, List, 0, Elements...> {
+    typedef List<Elements...> type;
+};
+
+// Services the N separate encoders Element<0>::type .. Element<N - 1>::type, i.e. the reference
+// the combined implementations are compared against
+template <template <uint8_t> class Element, uint8_t N>
+struct Separate {
+    typedef typename Element<N - 1>::type Encoder;
+    typedef Separate<Element, N - 1> Next;
+
+    static inline void init() {
+        Next::init();
+        Encoder::init();
+    }
+
+    static inline void service() __attribute__((always_inline)) {
+        Next::service();
+        Encoder::service();
+    }
+
+    static inline int16_t getValue(uint8_t encoder) {
+        return encoder == N - 1 ? Encoder::getValue() : Next::getValue(encoder);
+    }
+
+    static inline int32_t getValueBatch(uint8_t encoder) {
+        return encoder == N - 1 ? Encoder::getValueBatch() : Next::getValueBatch(encoder);
+    }
+
+    static inline int32_t getPosition(uint8_t encoder) {
+        return encoder == N - 1 ? Encoder::getPosition() : Next::getPosition(encoder);
+    }
+
+    // Consumes the pending steps of all encoders
+    static inline void consume() {
+        Next::consume();
+        Encoder::getValueBatch();
+    }
+
+    static inline ButtonState getButtonState(uint8_t encoder) {
+        return encoder == N - 1 ? Encoder::getButtonState() : Next::getButtonState(encoder);
+    }
+};
+
+template <template <uint8_t> class Element>
+struct Separate<Element, 0> {
+    static inline void init() {}
+    static inline void service() {}
+    static inline int16_t getValue(uint8_t) {
+        return 0;
+    }
+    static inline int32_t getValueBatch(uint8_t) {
+        return 0;
+    }
+    static inline int32_t getPosition(uint8_t) {
+        return 0;
+    }
+    static inline void consume() {}
+    static inline ButtonState getButtonState(uint8_t) {
+        return Open;
+    }
+};
+
+// Calls Body<1>::run(args...) .. Body<N>::run(args...)
+template <template <uint8_t> class Body, uint8_t N>
+struct ForEachCount {
+    template <typename... Args>
+    static void run(const Args &...args) {
+        ForEachCount<Body, N - 1>::run(args...);
+        Body<N>::run(args...);
+    }
+};
+
+template <template <uint8_t> class Body>
+struct ForEachCount<Body, 0> {
+    template <typename... Args>
+    static void run(const Args &...) {}
+};
+
+#endif // __have__BenchCommon_h__
@@ -0,0 +1,353 @@
+// ----------------------------------------------------------------------------
+// ISR cost benchmark for ClickButtonLadder vs. N separate analog ClickEncoder buttons
+//
+// N = 1..8 buttons share one analog pin (resistor ladder). Every tick the
+// ladder decodes all of them from a single ADC value, while the reference
+// calls N ClickEncoder::service() with analogInput = true, one per range.
+// Both must report exactly the same button states, also if a second ladder
+// on another analog pin shares the (mocked) ADC, and if every conversion
+// takes 104us so that the buttons have to take turns. No service() call may
+// wait for the ADC. The reference selected by analogReference() must be kept
+// by all conversions. encoderAnalogRead() of another pin by the application
+// in between must return the value of that pin.
+//
+// Options: --ticks <n> --repeats <n> --tick-micros <n> --seed <n>
+// ----------------------------------------------------------------------------
+
+#include <ClickButtonLadder.h>
+#include <ClickEncoder.h>
+
+#include "BenchCommon.h"
+
+#include <random>
+#include <vector>
+
+#define MAX_BUTTONS 8
+#define PIN_LADDER 2
+// Second ladder, which shares the ADC
+#define PIN_LADDER2 3
+// Both ladders again, with a busy ADC
+#define PIN_BUSY_LADDER 4
+#define PIN_BUSY_LADDER2 5
+// Read by the application in between
+#define PIN_APPLICATION 6
+
+// 13 ADC clocks at 125 kHz
+#define ADC_CONVERSION_MICROS 104
+
+// ADC window of button i, unpressed reads 1023
+#define RANGE_LOW(i) (40 + 120 * (i))
+#define RANGE_HIGH(i) (RANGE_LOW(i) + 80)
+
+// ---Compile time lists of N buttons---------------------------------------------
+
+template <uint8_t i>
+struct Range {
+    typedef AnalogRange<RANGE_LOW(i), RANGE_HIGH(i)> type;
+};
+
+// Every reference button needs its own encoder pins, else they would share the decoder state
+template <int8_t pin>
+struct Members {
+    template <uint8_t i>
+    struct Member {
+        typedef ClickEncoder<8 + 2 * i + 16 * (pin - PIN_LADDER), 9 + 2 * i + 16 * (pin - PIN_LADDER), pin, false, 4, 3072, 25, 2, 32, 1024, 512, true, RANGE_LOW(i), RANGE_HIGH(i)> type;
+    };
+};
+
+template <uint8_t N, int8_t pin = PIN_LADDER>
+struct MakeLadder {
+    typedef ClickButtonLadder<pin, typename MakeList<Range, AnalogRanges, N>::type> type;
+};
+
+// ---Benchmark-------------------------------------------------------------------
+
+// Random presses of random buttons: glitches, clicks, double clicks and long holds, with ADC noise
+static std::vector<int16_t> recordTrace(const BenchOptions &opts, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::vector<int16_t> trace;
+    trace.reserve(opts.ticks);
+
+    bool pressed = false;
+    while (trace.size() < opts.ticks) {
+        uint32_t r = rng() % 10;
+        uint32_t duration = r < 2 ? 1 + rng() % 40 : r < 6 ? 30 + rng() % 300 : r < 8 ? 500 + rng() % 1500 : rng() % 4000;
+        uint8_t button = rng() % MAX_BUTTONS;
+
+        for (uint32_t i = 0; i < duration && trace.size() < opts.ticks; ++i) {
+            int16_t noise = (int16_t)(rng() % 21) - 10;
+            trace.push_back(pressed ? (int16_t)((RANGE_LOW(button) + RANGE_HIGH(button)) / 2 + noise) : (int16_t)(1013 + noise));
+        }
+        pressed = !pressed;
+    }
+    return trace;
+}
+
+static inline void replay(int16_t value, const BenchOptions &opts) __attribute__((always_inline));
+static inline void replay(int16_t value, const BenchOptions &opts) {
+    mock::setAnalog(PIN_LADDER, value);
+    mock::advanceMicros(opts.tickMicros);
+}
+
+template <typename Body>
+static Result measure(const std::vector<int16_t> &trace, const BenchOptions &opts, Body body) {
+    return measure(trace.size(), opts, [&trace, &opts](size_t i) { replay(trace[i], opts); }, body);
+}
+
+static void report(uint8_t buttons, const char *variant, const Result &result, const Result &baseline) {
+    printf("buttons=%u %-18s", buttons, variant);
+    printCost(result, baseline, "tick");
+}
+
+// Runs both implementations side by side and compares every button state. With ticks of 1ms, both
+// must also match a plain state machine, which checks the value of the tick before every button check.
+template <uint8_t N>
+static bool verify(const std::vector<int16_t> &trace, const BenchOptions &opts, uint32_t &events) {
+    typedef typename MakeLadder<N>::type Ladder;
+    typedef typename MakeList<Range, AnalogRanges, N>::type Ranges;
+
+    replay(trace[0], opts);
+    Ladder::init();
+    Separate<Members<PIN_LADDER>::Member, N>::init();
+
+    // Plain state machine of every button, same start as ClickButtonLadder::lastButtonCheck
+    bool latency = opts.tickMicros == 1000;
+    unsigned long lastCheck = 0;
+    uint16_t keyDownTicks[N] = {0};
+    uint16_t doubleClickTicks[N] = {0};
+    ButtonState expected[N] = {};
+
+    events = 0;
+    for (size_t t = 0; t < trace.size(); ++t) {
+        replay(trace[t], opts);
+        Ladder::service();
+        Separate<Members<PIN_LADDER>::Member, N>::service();
+
+        if (latency && t && millis() - lastCheck >= 32) {
+            lastCheck = millis();
+            uint8_t pressed = Ranges::find(trace[t - 1], 0);
+            for (uint8_t b = 0; b < N; ++b) {
+                ButtonState *state = &expected[b];
+                ButtonStateMachine<32, 1024, 512>::tick(b == pressed, keyDownTicks[b], doubleClickTicks[b], *state, true, true,
+                                                         [state](ButtonState s) { *state = s; });
+            }
+        }
+
+        for (uint8_t b = 0; b < N; ++b) {
+            ButtonState ladder = Ladder::getButtonState(b);
+            ButtonState separate = Separate<Members<PIN_LADDER>::Member, N>::getButtonState(b);
+            if (ladder != separate) {
+                printf("buttons=%u MISMATCH at tick %lu button %u: ladder %d separate %d\n", N, (unsigned long)t, b, ladder, separate);
+                return false;
+            }
+            if (latency && ladder != expected[b]) {
+                printf("buttons=%u MISMATCH at tick %lu button %u: ladder %d expected %d\n", N, (unsigned long)t, b, ladder, expected[b]);
+                return false;
+            }
+            if (expected[b] != Held) {
+                expected[b] = Open;
+            }
+            events += ladder != Open;
+        }
+    }
+    return true;
+}
+
+// Two ladders and their reference buttons on two analog pins share the ADC,
+// every button must still only see the values of its own pin
+template <uint8_t N>
+static bool verifySharedAdc(const std::vector<int16_t> &trace, const std::vector<int16_t> &trace2, const BenchOptions &opts) {
+    typedef typename MakeLadder<N>::type Ladder;
+    typedef typename MakeLadder<N, PIN_LADDER2>::type Ladder2;
+    typedef Separate<Members<PIN_LADDER>::Member, N> Reference;
+    typedef Separate<Members<PIN_LADDER2>::Member, N> Reference2;
+
+    mock::setAnalog(PIN_LADDER2, trace2[0]);
+    replay(trace[0], opts);
+    Ladder::init();
+    Ladder2::init();
+    Reference::init();
+    Reference2::init();
+
+    for (size_t t = 0; t < trace.size(); ++t) {
+        mock::setAnalog(PIN_LADDER2, trace2[t]);
+        replay(trace[t], opts);
+        Ladder::service();
+        Ladder2::service();
+        Reference::service();
+        Reference2::service();
+
+        for (uint8_t b = 0; b < N; ++b) {
+            if (Ladder::getButtonState(b) != Reference::getButtonState(b) || Ladder2::getButtonState(b) != Reference2::getButtonState(b)) {
+                printf("buttons=%u MISMATCH at tick %lu button %u with a shared ADC\n", N, (unsigned long)t, b);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Presses for the busy ADC: clicks of 4 and holds of 64 button intervals, 40 intervals apart. If the ADC can
+// not convert all buttons within the tick before their check, a button sees the value of the previous check.
+// The presses are far enough from the click, double click & hold times, that this does not change the events.
+static std::vector<int16_t> recordSlowTrace(const BenchOptions &opts, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::vector<int16_t> trace;
+    trace.reserve(opts.ticks);
+    uint32_t presses = 0;
+
+    while (trace.size() < opts.ticks) {
+        uint32_t duration = rng() % 2 ? 4 * 32 : 64 * 32;
+        uint8_t button = (uint8_t)(presses++ % MAX_BUTTONS);
+        for (uint32_t i = 0; i < duration + 40 * 32 && trace.size() < opts.ticks; ++i) {
+            int16_t noise = (int16_t)(rng() % 21) - 10;
+            trace.push_back(i < duration ? (int16_t)((RANGE_LOW(button) + RANGE_HIGH(button)) / 2 + noise) : (int16_t)(1013 + noise));
+        }
+    }
+    return trace;
+}
+
+// Appends every new button event, Held only once per press
+static inline void recordEvent(std::vector<ButtonState> &events, ButtonState &last, ButtonState state) {
+    if (state != Open && !(state == Held && last == Held)) {
+        events.push_back(state);
+    }
+    last = state;
+}
+
+// Same as verifySharedAdc() with a busy ADC: all 2 * (N + 1) buttons check within the same tick, every
+// conversion takes ADC_CONVERSION_MICROS and a service() call must never wait for one. The conversions
+// are spread over the following ticks, so a button might see the value of the previous check instead of the
+// tick before its check. Therefore the order of the events is compared instead of the ticks they occur in.
+// With applicationReads the application reads another pin after every tick, while the conversions of
+// the buttons still run in the background. Every read has to return the value of that pin.
+template <uint8_t N>
+static bool verifyBusyAdc(const std::vector<int16_t> &trace, const std::vector<int16_t> &trace2, bool applicationReads, unsigned long &maxWait) {
+    typedef typename MakeLadder<N, PIN_BUSY_LADDER>::type Ladder;
+    typedef typename MakeLadder<N, PIN_BUSY_LADDER2>::type Ladder2;
+    typedef Separate<Members<PIN_BUSY_LADDER>::Member, N> Reference;
+    typedef Separate<Members<PIN_BUSY_LADDER2>::Member, N> Reference2;
+
+    mock::adcConversionMicros() = ADC_CONVERSION_MICROS;
+
+    mock::setAnalog(PIN_BUSY_LADDER, trace[0]);
+    mock::setAnalog(PIN_BUSY_LADDER2, trace2[0]);
+    Ladder::init();
+    Ladder2::init();
+    Reference::init();
+    Reference2::init();
+
+    // Ticks of 1ms, independent of --tick-micros
+    unsigned long start = (micros() / 1000 + 1) * 1000;
+    bool ok = true;
+    maxWait = 0;
+
+    // Events of the ladders & the references, per button
+    std::vector<ButtonState> events[4][N];
+    ButtonState last[4][N] = {};
+
+    for (size_t t = 0; t < trace.size() && ok; ++t) {
+        mock::microsCounter() = start + t * 1000;
+        mock::setAnalog(PIN_BUSY_LADDER, trace[t]);
+        mock::setAnalog(PIN_BUSY_LADDER2, trace2[t]);
+
+        unsigned long before = micros();
+        Ladder::service();
+        Ladder2::service();
+        Reference::service();
+        Reference2::service();
+        unsigned long wait = micros() - before;
+        if (wait > maxWait) {
+            maxWait = wait;
+        }
+
+        for (uint8_t b = 0; b < N; ++b) {
+            recordEvent(events[0][b], last[0][b], Ladder::getButtonState(b));
+            recordEvent(events[1][b], last[1][b], Reference::getButtonState(b));
+            recordEvent(events[2][b], last[2][b], Ladder2::getButtonState(b));
+            recordEvent(events[3][b], last[3][b], Reference2::getButtonState(b));
+        }
+
+        if (applicationReads) {
+            int16_t value = (int16_t)(t % 1024);
+            mock::setAnalog(PIN_APPLICATION, value);
+            int16_t read = encoderAnalogRead(PIN_APPLICATION);
+            if (read != value) {
+                printf("buttons=%u MISMATCH at tick %lu: application read %d instead of %d\n", N, (unsigned long)t, read, value);
+                ok = false;
+            }
+        }
+    }
+
+    size_t total = 0;
+    for (uint8_t b = 0; b < N && ok; ++b) {
+        total += events[0][b].size() + events[2][b].size();
+        if (events[0][b] != events[1][b] || events[2][b] != events[3][b]) {
+            printf("buttons=%u MISMATCH of the events of button %u with a busy ADC (%lu vs. %lu, %lu vs. %lu)\n", N, b,
+                   (unsigned long)events[0][b].size(), (unsigned long)events[1][b].size(), (unsigned long)events[2][b].size(), (unsigned long)events[3][b].size());
+            ok = false;
+        }
+    }
+
+    if (ok && !total) {
+        printf("buttons=%u MISMATCH: no button events with a busy ADC\n", N);
+        ok = false;
+    }
+
+    mock::adcConversionMicros() = 0;
+    // Every button polls the ADC at most twice per tick, each poll of a busy ADC takes 1us
+    return ok && maxWait <= 2 * 2 * (N + 1);
+}
+
+template <uint8_t N>
+struct Run {
+    static void run(const std::vector<int16_t> &trace, const BenchOptions &opts, const Result &baseline) {
+        typedef typename MakeLadder<N>::type Ladder;
+
+        // Registers the ladder with the ADC, the reference buttons were already initialized by verify()
+        Ladder::init();
+
+        report(N, "ClickEncoder x N", measure(trace, opts, []() { Separate<Members<PIN_LADDER>::Member, N>::service(); }), baseline);
+        report(N, "ClickButtonLadder", measure(trace, opts, []() { Ladder::service(); }), baseline);
+    }
+};
+
+int main(int argc, char **argv) {
+    BenchOptions opts;
+    opts.ticks = 1u << 20;
+    parseOptions(argc, argv, opts);
+
+    // Any reference other than the reset value of ADMUX
+    analogReference(INTERNAL);
+
+    std::vector<int16_t> trace = recordTrace(opts, opts.seed);
+
+    // Verify first, as the measurements leave the buttons in an arbitrary state
+    uint32_t events;
+    bool ok = verify<MAX_BUTTONS>(trace, opts, events);
+    printf("buttons=%u %-18s %s (%lu button events)\n", MAX_BUTTONS, "ladder vs. separate", ok ? "match" : "MISMATCH", (unsigned long)events);
+
+    bool shared = verifySharedAdc<MAX_BUTTONS>(trace, recordTrace(opts, opts.seed + 1), opts);
+    printf("buttons=%u %-18s %s\n", MAX_BUTTONS, "two analog pins", shared ? "match" : "MISMATCH");
+    ok = ok && shared;
+
+    unsigned long maxWait;
+    std::vector<int16_t> slowTrace = recordSlowTrace(opts, opts.seed);
+    std::vector<int16_t> slowTrace2 = recordSlowTrace(opts, opts.seed + 1);
+    bool busy = verifyBusyAdc<MAX_BUTTONS>(slowTrace, slowTrace2, false, maxWait);
+    printf("buttons=%u %-18s %s (max. %lu us per tick)\n", MAX_BUTTONS, "busy ADC", busy ? "match" : "MISMATCH", maxWait);
+    ok = ok && busy;
+
+    bool application = verifyBusyAdc<MAX_BUTTONS>(slowTrace, slowTrace2, true, maxWait);
+    printf("buttons=%u %-18s %s (max. %lu us per tick)\n", MAX_BUTTONS, "application reads", application ? "match" : "MISMATCH", maxWait);
+    ok = ok && application;
+
+    bool reference = (ADMUX & (_BV(REFS1) | _BV(REFS0))) == (INTERNAL << REFS0);
+    printf("buttons=%u %-18s %s\n", MAX_BUTTONS, "analog reference", reference ? "kept" : "OVERWRITTEN");
+    ok = ok && reference;
+
+    Result baseline = measure(trace, opts, []() {});
+    ForEachCount<Run, MAX_BUTTONS>::run(trace, opts, baseline);
+
+    return ok ? 0 : 1;
+}
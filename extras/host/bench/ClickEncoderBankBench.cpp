@@ -0,0 +1,153 @@
+// ----------------------------------------------------------------------------
+// ISR cost benchmark for ClickEncoderBank vs. N separate ClickEncoder instances
+//
+// N = 1..8 encoders are wired to a 16 bit port (mock ports 0 & 1, encoder i
+// uses the pins 2i & 2i+1). Every tick the bank decodes all of them with a
+// single port read, while the reference calls N ClickEncoder::service().
+// Both must produce exactly the same getValue(), getValueBatch() & getPosition()
+// results, incl. acceleration.
+//
+// Options: --rpm <float> --bounce <ticks> --jitter <fraction> --ticks <n> --repeats <n> --tick-micros <n>
+//          --spinning <n> (number of encoders that are turned at the same time, default 1)
+// ----------------------------------------------------------------------------
+
+#include <ClickEncoder.h>
+#include <ClickEncoderBank.h>
+
+#include "BenchCommon.h"
+#include "EncoderSim.h"
+
+#include <vector>
+
+#define MAX_ENCODERS 8
+
+struct MockPort16 {
+    typedef uint16_t port_t;
+    static inline port_t read() __attribute__((always_inline)) {
+        return (port_t)(mock::ports()[0] | (mock::ports()[1] << 8));
+    }
+};
+
+// ---Compile time lists of N encoders--------------------------------------------
+
+template <uint8_t i>
+struct Channel {
+    typedef EncoderChannel<2 * i, 2 * i + 1> type;
+};
+
+template <uint8_t i>
+struct Member {
+    typedef ClickEncoder<2 * i, 2 * i + 1> type;
+};
+
+template <uint8_t N>
+struct MakeBank {
+    typedef ClickEncoderBank<MockPort16, typename MakeList<Channel, EncoderChannels, N>::type> type;
+};
+
+// ---Benchmark-------------------------------------------------------------------
+
+static std::vector<uint16_t> recordTrace(const BenchOptions &opts) {
+    std::vector<EncoderSim> sims;
+    for (uint8_t i = 0; i < MAX_ENCODERS; ++i) {
+        EncoderSimConfig enc;
+        enc.pinA = 2 * i;
+        enc.pinB = 2 * i + 1;
+        // Let every encoder spin at a different speed & direction
+        enc.rpm = i < opts.spinning ? (i & 1 ? -1.0 : 1.0) * opts.rpm * (1.0 + 0.25 * i) : 0.0;
+        enc.bounceTicks = opts.bounce;
+        enc.jitter = opts.jitter;
+        enc.tickMicros = opts.tickMicros;
+        enc.seed = i + 1;
+        sims.push_back(EncoderSim(enc));
+    }
+
+    std::vector<uint16_t> trace;
+    trace.reserve(opts.ticks);
+    for (uint32_t t = 0; t < opts.ticks; ++t) {
+        for (size_t i = 0; i < sims.size(); ++i) {
+            sims[i].tick();
+        }
+        trace.push_back(MockPort16::read());
+    }
+    return trace;
+}
+
+static inline void replay(uint16_t value) __attribute__((always_inline));
+static inline void replay(uint16_t value) {
+    mock::ports()[0] = (uint8_t)value;
+    mock::ports()[1] = (uint8_t)(value >> 8);
+}
+
+template <typename Body>
+static Result measure(const std::vector<uint16_t> &trace, const BenchOptions &opts, Body body) {
+    return measure(trace.size(), opts, [&trace](size_t i) { replay(trace[i]); }, body);
+}
+
+static void report(uint8_t encoders, const char *variant, const Result &result, const Result &baseline) {
+    printf("encoders=%u %-18s", encoders, variant);
+    printCost(result, baseline, "tick");
+}
+
+// Runs both implementations side by side and compares every result, even channels are consumed
+// by getValue(), odd ones by getValueBatch()
+template <uint8_t N>
+static bool verify(const std::vector<uint16_t> &trace) {
+    typedef typename MakeBank<N>::type Bank;
+
+    replay(trace[0]);
+    Bank::init();
+    Separate<Member, N>::init();
+
+    for (size_t t = 0; t < trace.size(); ++t) {
+        replay(trace[t]);
+        Bank::service();
+        Separate<Member, N>::service();
+
+        // Consume values only every few ticks, so that acceleration & pending steps matter
+        if ((t & 7) == 0) {
+            for (uint8_t c = 0; c < N; ++c) {
+                int32_t bank = c & 1 ? Bank::getValueBatch(c) : Bank::getValue(c);
+                int32_t separate = c & 1 ? Separate<Member, N>::getValueBatch(c) : Separate<Member, N>::getValue(c);
+                if (bank != separate) {
+                    printf("encoders=%u MISMATCH at tick %lu channel %u: bank %ld separate %ld\n", N, (unsigned long)t, c, (long)bank, (long)separate);
+                    return false;
+                }
+            }
+        }
+        for (uint8_t c = 0; c < N; ++c) {
+            if (Bank::getPosition(c) != Separate<Member, N>::getPosition(c)) {
+                printf("encoders=%u MISMATCH at tick %lu channel %u: position bank %ld separate %ld\n", N, (unsigned long)t, c,
+                       (long)Bank::getPosition(c), (long)Separate<Member, N>::getPosition(c));
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+template <uint8_t N>
+struct Run {
+    static void run(const std::vector<uint16_t> &trace, const BenchOptions &opts, const Result &baseline) {
+        typedef typename MakeBank<N>::type Bank;
+
+        report(N, "ClickEncoder x N", measure(trace, opts, []() { Separate<Member, N>::service(); }), baseline);
+        report(N, "ClickEncoderBank", measure(trace, opts, []() { Bank::service(); }), baseline);
+    }
+};
+
+int main(int argc, char **argv) {
+    BenchOptions opts;
+    parseOptions(argc, argv, opts);
+
+    std::vector<uint16_t> trace = recordTrace(opts);
+
+    // Verify first, as the measurements leave the encoders in an arbitrary state
+    bool ok = verify<MAX_ENCODERS>(trace);
+    printf("encoders=%u %-18s %s\n", MAX_ENCODERS, "bank vs. separate", ok ? "match" : "MISMATCH");
+
+    Result baseline = measure(trace, opts, []() {});
+    ForEachCount<Run, MAX_ENCODERS>::run(trace, opts, baseline);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,488 @@
+// ----------------------------------------------------------------------------
+// ISR cost benchmark for ClickEncoder
+//
+// This file is compiled once per build configuration (see CMakeLists.txt),
+// as the configuration is selected through preprocessor defines. It replays
+// a pre-recorded synthetic encoder waveform and reports the cost of every
+// service entry point in ns/call and (if available) instructions/call.
+// With BUTTON_ISR_SERVICE it also checks the edge driven button against
+// polling, a mismatch fails the run. Together with ROTARY_ISR_SERVICE the
+// acceleration has to decay while service() only runs at the deadlines.
+//
+// Options: --rpm <float> --bounce <ticks> --jitter <fraction> --ticks <n> --repeats <n> --tick-micros <n> --seed <n>
+// ----------------------------------------------------------------------------
+
+#include <ClickEncoder.h>
+
+#include "BenchCommon.h"
+#include "EncoderSim.h"
+
+#include <math.h>
+#include <random>
+#include <vector>
+
+#ifndef BENCH_CONFIG
+#define BENCH_CONFIG "default"
+#endif
+
+#ifndef BENCH_DECODER
+#define BENCH_DECODER QuarterStepDecoder
+#endif
+#ifndef BENCH_STEPS_PER_NOTCH
+#define BENCH_STEPS_PER_NOTCH 4
+#endif
+
+#define PIN_A 0
+#define PIN_B 1
+#define PIN_BTN 2
+#define STEPS_PER_NOTCH BENCH_STEPS_PER_NOTCH
+// Quadrature transitions per notch of the simulated encoder
+#define SIM_STEPS_PER_NOTCH 4
+
+#define BUTTON_INTERVAL 32
+#define BUTTON_HOLD_TIME 1024
+#define BUTTON_DOUBLECLICK_TIME 512
+
+#ifndef WITHOUT_BUTTON
+typedef ClickEncoder<PIN_A, PIN_B, PIN_BTN, false, STEPS_PER_NOTCH, 3072, 25, 2, BUTTON_INTERVAL, BUTTON_HOLD_TIME, BUTTON_DOUBLECLICK_TIME, false, 0, 0, BENCH_DECODER> Encoder;
+#else
+typedef ClickEncoder<PIN_A, PIN_B, false, STEPS_PER_NOTCH, 3072, 25, 2, BENCH_DECODER> Encoder;
+#endif
+
+#if defined(ROTARY_ISR_SERVICE) && defined(SPLIT_ROTARY_ISR_SERVICE)
+#define ROTARY_ISR() \
+    do {                          \
+        Encoder::servicePinA();   \
+        Encoder::servicePinB();   \
+    } while (0)
+#elif defined(ROTARY_ISR_SERVICE)
+#define ROTARY_ISR() Encoder::rotaryService()
+#else
+#define ROTARY_ISR() \
+    do {             \
+    } while (0)
+#endif
+
+#ifdef BUTTON_ISR_SERVICE
+#define BUTTON_ISR() Encoder::serviceButtonEdge()
+#else
+#define BUTTON_ISR() \
+    do {             \
+    } while (0)
+#endif
+
+// All pin change interrupts that would be triggered by the waveform
+#define PIN_ISRS()    \
+    do {              \
+        ROTARY_ISR(); \
+        BUTTON_ISR(); \
+    } while (0)
+
+#if defined(BUTTON_ISR_SERVICE) && defined(ROTARY_ISR_SERVICE)
+// No periodic tick at all: service() is only called at the deadlines reported by nextButtonDeadline(), also while rotating
+static inline void serviceAtDeadline() {
+    unsigned long deadline;
+    if (Encoder::nextButtonDeadline(deadline) && (long)(millis() - deadline) >= 0) {
+        Encoder::service();
+    }
+}
+#define SERVICE() serviceAtDeadline()
+#else
+#define SERVICE() Encoder::service()
+#endif
+
+struct Trace {
+    // Port before the first tick, the simulated rotation starts from it
+    uint8_t initialPort;
+    std::vector<uint8_t> port;
+    // Ideal transitions the decoder has accepted by the end of the trace, i.e. without those still
+    // held back by its filter
+    int32_t expectedSteps;
+};
+
+static Trace recordTrace(const BenchOptions &opts) {
+    EncoderSimConfig enc;
+    enc.pinA = PIN_A;
+    enc.pinB = PIN_B;
+    enc.rpm = opts.rpm;
+    enc.bounceTicks = opts.bounce;
+    enc.jitter = opts.jitter;
+    enc.tickMicros = opts.tickMicros;
+
+    ButtonSimConfig btn;
+#ifndef WITHOUT_BUTTON
+    btn.pin = PIN_BTN;
+    btn.pressMillis = 150;
+    btn.periodMillis = 700;
+#endif
+
+    EncoderSim sim(enc, btn);
+
+    Trace trace;
+    trace.initialPort = (uint8_t)mock::ports()[0];
+    trace.port.reserve(opts.ticks);
+    trace.expectedSteps = 0;
+    // A FilteredDecoder accepts a level with its filterDepth-th sample
+    uint32_t filterLag = BENCH_DECODER::filterDepth > 1 ? BENCH_DECODER::filterDepth - 1 : 0;
+    for (uint32_t i = 0; i < opts.ticks; ++i) {
+        sim.tick();
+        trace.port.push_back((uint8_t)mock::ports()[0]);
+        if (i + filterLag < opts.ticks) {
+            trace.expectedSteps = sim.expectedSteps();
+        }
+    }
+    return trace;
+}
+
+// Replays the trace and runs body once per tick, keeps the fastest repetition
+template <typename Body>
+static Result measure(const Trace &trace, const BenchOptions &opts, Body body) {
+    return measure(
+        trace.port.size(), opts,
+        [&trace]() {
+            // init() samples the pins, which must match the start of the trace
+            mock::ports()[0] = trace.port[0];
+            Encoder::init();
+        },
+        [&trace, &opts](size_t i) {
+            mock::ports()[0] = trace.port[i];
+            mock::advanceMicros(opts.tickMicros);
+        },
+        body);
+}
+
+static void report(const char *function, const Result &result, const Result &baseline) {
+    printf("%-40s %-18s", BENCH_CONFIG, function);
+    printCost(result, baseline, "call");
+}
+
+// Sanity check of the decoded notches, so that functional regressions show up next to the numbers.
+// Runs before the measurements, which leave the encoder with an arbitrary partial notch.
+// Without bounce & jitter every step has to be decoded, else the check fails.
+static bool checkNotches(const Trace &trace, const BenchOptions &opts) {
+    mock::ports()[0] = trace.initialPort;
+    Encoder::init();
+    Encoder::setAccelerationEnabled(false);
+#ifdef ENC_EVENT_QUEUE_SIZE
+    EncoderEvent event;
+#endif
+    int32_t notches = 0;
+    int32_t startPosition = Encoder::getPosition();
+#ifdef ENC_STATISTICS
+    EncoderStatistics before;
+    Encoder::getStatistics(before);
+#endif
+    for (size_t i = 0; i < trace.port.size(); ++i) {
+        mock::ports()[0] = trace.port[i];
+        mock::advanceMicros(opts.tickMicros);
+        PIN_ISRS();
+        SERVICE();
+#ifdef ENC_EVENT_QUEUE_SIZE
+        // Drain the queue only every 64 ticks, like a slow UI thread would do
+        if ((i & 63) == 0) {
+            while (Encoder::getEvent(event)) {
+                if (event.type == EncoderRotated) {
+                    notches += event.notches;
+                }
+            }
+        }
+#else
+        notches += Encoder::getValue();
+#endif
+    }
+#ifdef ENC_EVENT_QUEUE_SIZE
+    while (Encoder::getEvent(event)) {
+        if (event.type == EncoderRotated) {
+            notches += event.notches;
+        }
+    }
+#endif
+    int32_t position = Encoder::getPosition() - startPosition;
+    Encoder::setAccelerationEnabled(true);
+
+    // The simulation starts on a detent and the decoder reports the last detent reached, so the steps
+    // truncate the transitions towards zero. Consuming notches truncates towards zero as well, the
+    // position rounds the steps towards negative infinity.
+    int32_t idealSteps = trace.expectedSteps / (SIM_STEPS_PER_NOTCH / STEPS_PER_NOTCH);
+    int32_t idealNotches = idealSteps / STEPS_PER_NOTCH;
+    int32_t idealPosition = (idealSteps - (idealSteps < 0 ? STEPS_PER_NOTCH - 1 : 0)) / STEPS_PER_NOTCH;
+
+    // The decoder can only follow one transition per tick, a FilteredDecoder one per filterDepth ticks
+    double stepsPerTick = fabs(opts.rpm) / 60.0 * EncoderSimConfig().stepsPerRevolution * opts.tickMicros / 1e6;
+    uint8_t ticksPerStep = BENCH_DECODER::filterDepth > 1 ? BENCH_DECODER::filterDepth : 1;
+    bool clean = opts.bounce == 0 && opts.jitter == 0.0 && stepsPerTick * ticksPerStep <= 1.0;
+    bool notchesOk = !clean || notches == idealNotches;
+#ifdef ENC_COMPACT_STATE
+    // The 16 bit step position wraps around
+    bool positionOk = !clean || (position - idealPosition) % (65536 / STEPS_PER_NOTCH) == 0;
+#else
+    bool positionOk = !clean || position == idealPosition;
+#endif
+    printf("%-40s %-18s %9ld decoded %9ld ideal%s\n", BENCH_CONFIG, "notches", (long)notches, (long)idealNotches, notchesOk ? "" : " MISMATCH");
+    printf("%-40s %-18s %9ld decoded %9ld ideal%s\n", BENCH_CONFIG, "position", (long)position, (long)idealPosition, positionOk ? "" : " MISMATCH");
+
+#ifdef ENC_STATISTICS
+    // Counters of the sanity run only
+    EncoderStatistics after;
+    Encoder::getStatistics(after);
+    printf("%-40s %-18s %9lu service %9lu steps %6u jitter %6u illegal %6u overflows %6u dropped %6u top\n", BENCH_CONFIG, "statistics",
+           (unsigned long)(after.serviceCalls - before.serviceCalls),
+           (unsigned long)(after.steps - before.steps),
+           (unsigned)(uint16_t)(after.jitterRejections - before.jitterRejections),
+           (unsigned)(uint16_t)(after.illegalTransitions - before.illegalTransitions),
+           (unsigned)(uint16_t)(after.deltaOverflows - before.deltaOverflows),
+           (unsigned)(uint16_t)(after.droppedButtonEvents - before.droppedButtonEvents),
+           (unsigned)(uint16_t)(after.accelerationTopHits - before.accelerationTopHits));
+#endif
+    return notchesOk && positionOk;
+}
+
+#ifdef BUTTON_ISR_SERVICE
+// The edge driven button has to report the same states in the same ticks as polling the button every 1ms,
+// which is the claim of BUTTON_ISR_SERVICE. Random presses (glitches, clicks, double clicks & long holds)
+// are fed into serviceButtonEdge(), service() is only called at the reported deadlines, while held & double clicks
+// get enabled and disabled at random. The reference runs the button state machine every ENC_BUTTONINTERVAL. Runs first, as it expects an idle button.
+static bool checkButtonEdges(const BenchOptions &opts) {
+    typedef ButtonStateMachine<BUTTON_INTERVAL, BUTTON_HOLD_TIME, BUTTON_DOUBLECLICK_TIME> Reference;
+
+    std::mt19937 rng(opts.seed);
+    bool pressed = false;
+    mock::setPin(PIN_BTN, !pressed);
+    Encoder::init();
+
+    uint16_t keyDownTicks = 0;
+    uint16_t doubleClickTicks = 0;
+    ButtonState state = Open;
+    unsigned long lastCheck = millis();
+
+    uint32_t ticks = 0;
+    uint32_t events = 0;
+    while (ticks < opts.ticks) {
+        uint32_t r = rng() % 10;
+        uint32_t duration = r < 2 ? 1 + rng() % 40 : r < 6 ? 30 + rng() % 300 : r < 8 ? 500 + rng() % 1500 : rng() % 4000;
+
+        for (uint32_t i = 0; i < duration && ticks < opts.ticks; ++i, ++ticks) {
+            // The claim is about 1ms polling, independent of --tick-micros
+            mock::setPin(PIN_BTN, !pressed);
+            mock::advanceMicros(1000);
+            if (i == 0) {
+                Encoder::serviceButtonEdge();
+            }
+            unsigned long deadline;
+            if (Encoder::nextButtonDeadline(deadline) && (long)(millis() - deadline) >= 0) {
+                Encoder::service();
+            }
+
+            unsigned long now = millis();
+            if (now - lastCheck >= BUTTON_INTERVAL) {
+                lastCheck = now;
+                Reference::tick(pressed, keyDownTicks, doubleClickTicks, state, Encoder::getButtonHeldEnabled(), Encoder::getDoubleClickEnabled(),
+                                [&state](ButtonState changed) { state = changed; });
+            }
+            ButtonState expected = state;
+            if (state != Held) {
+                state = Open;
+            }
+
+            ButtonState actual = Encoder::getButtonState();
+            if (actual != expected) {
+                printf("%-40s %-18s MISMATCH at tick %lu: edges %d polling %d\n", BENCH_CONFIG, "button edges", (unsigned long)ticks, actual, expected);
+                return false;
+            }
+            events += actual != Open;
+
+            // The settings only apply to the ticks after the change, also to the ticks not evaluated yet by the edge driven button
+            if (rng() % 1000 == 0) {
+                Encoder::setButtonHeldEnabled(!Encoder::getButtonHeldEnabled());
+            }
+            if (rng() % 1000 == 0) {
+                Encoder::setDoubleClickEnabled(!Encoder::getDoubleClickEnabled());
+            }
+        }
+        pressed = !pressed;
+    }
+    Encoder::setButtonHeldEnabled(true);
+    Encoder::setDoubleClickEnabled(true);
+    printf("%-40s %-18s match (%lu button events)\n", BENCH_CONFIG, "button edges", (unsigned long)events);
+    return true;
+}
+#endif
+
+// Moves the pins one transition forward
+static inline void turnForward() {
+    // Active pins read low
+    uint8_t levels = (!mock::getPin(PIN_A) << 1) | !mock::getPin(PIN_B);
+    uint8_t position = ((levels ^ (levels >> 1)) + 1) & 0x03;
+    levels = position ^ (position >> 1);
+    mock::setPin(PIN_A, !(levels >> 1));
+    mock::setPin(PIN_B, !(levels & 0x01));
+}
+
+#if defined(ENC_STATISTICS) && !defined(ENC_EVENT_QUEUE_SIZE)
+// Turns forward one transition per tick with acceleration, the steps are consumed only every 100 ticks.
+// Once the acceleration reached ENC_ACCEL_TOP (after 3072 / (25 - 2) steps), every step has to count as
+// a top hit, no matter how often the acceleration gets folded with ROTARY_ACCEL_OPTIMIZATION.
+static bool checkAccelerationTopHits() {
+    Encoder::setAccelerationEnabled(true);
+    EncoderStatistics before;
+    Encoder::getStatistics(before);
+    for (uint32_t i = 0; i < 2000; ++i) {
+        turnForward();
+        mock::advanceMicros(1000);
+        PIN_ISRS();
+        SERVICE();
+        if (i % 100 == 99) {
+            Encoder::getValueBatch();
+        }
+    }
+    EncoderStatistics after;
+    Encoder::getStatistics(after);
+
+    unsigned long steps = after.steps - before.steps;
+    unsigned hits = (uint16_t)(after.accelerationTopHits - before.accelerationTopHits);
+    bool ok = hits <= steps && hits >= steps - steps / 4;
+    printf("%-40s %-18s %9u top hits %9lu steps%s\n", BENCH_CONFIG, "acceleration top", hits, steps, ok ? "" : " MISMATCH");
+    return ok;
+}
+#endif
+
+#if defined(BUTTON_ISR_SERVICE) && defined(ROTARY_ISR_SERVICE)
+// All complete notches incl. acceleration, from the event queue if there is one
+static int32_t consumeNotches() {
+#ifdef ENC_EVENT_QUEUE_SIZE
+    int32_t notches = 0;
+    EncoderEvent event;
+    while (Encoder::getEvent(event)) {
+        if (event.type == EncoderRotated) {
+            notches += event.notches;
+        }
+    }
+    return notches;
+#else
+    return Encoder::getValueBatch();
+#endif
+}
+
+// Spins the encoder up with the trace, then idles for 10s. The acceleration must have decayed by then,
+// so that the next notch counts 1, and no deadline must be left.
+static bool checkIdleAcceleration(const Trace &trace, const BenchOptions &opts) {
+    mock::ports()[0] = trace.initialPort;
+    Encoder::init();
+    for (size_t i = 0; i < trace.port.size(); ++i) {
+        mock::ports()[0] = trace.port[i];
+        mock::advanceMicros(opts.tickMicros);
+        PIN_ISRS();
+        SERVICE();
+        consumeNotches();
+    }
+
+    // Release the button, its timeouts pass within the idle time as well
+    mock::setPin(PIN_BTN, true);
+    Encoder::serviceButtonEdge();
+    for (uint32_t i = 0; i < 10000; ++i) {
+        mock::advanceMicros(1000);
+        SERVICE();
+    }
+    unsigned long deadline;
+    bool idle = !Encoder::nextButtonDeadline(deadline);
+
+    // Turn forward one transition at a time until the next notch completes
+    int32_t value = 0;
+    for (uint8_t i = 0; i < 2 * SIM_STEPS_PER_NOTCH && value == 0; ++i) {
+        turnForward();
+        mock::advanceMicros(1000);
+        PIN_ISRS();
+        SERVICE();
+        value = consumeNotches();
+    }
+
+    bool ok = idle && (value == 1 || value == -1);
+    printf("%-40s %-18s %9ld value after 10s idle%s%s\n", BENCH_CONFIG, "idle acceleration", (long)value,
+           idle ? "" : ", deadline left", ok ? "" : " MISMATCH");
+    return ok;
+}
+#endif
+
+int main(int argc, char **argv) {
+    BenchOptions opts;
+    parseOptions(argc, argv, opts);
+
+    Trace trace = recordTrace(opts);
+
+#ifdef ENC_COMPACT_STATE
+    printf("%-40s %-18s %9u bytes\n", BENCH_CONFIG, "state", (unsigned)Encoder::stateBytes);
+#endif
+
+    bool ok = true;
+#ifdef BUTTON_ISR_SERVICE
+    ok = checkButtonEdges(opts);
+#endif
+    ok = checkNotches(trace, opts) && ok;
+#if defined(ENC_STATISTICS) && !defined(ENC_EVENT_QUEUE_SIZE)
+    ok = checkAccelerationTopHits() && ok;
+#endif
+#if defined(BUTTON_ISR_SERVICE) && defined(ROTARY_ISR_SERVICE)
+    ok = checkIdleAcceleration(trace, opts) && ok;
+#endif
+
+    Result baseline = measure(trace, opts, []() {});
+
+    Result service = measure(trace, opts, []() {
+        Encoder::service();
+    });
+    report("service", service, baseline);
+
+#if defined(ROTARY_ISR_SERVICE) && defined(SPLIT_ROTARY_ISR_SERVICE)
+    report("servicePinA", measure(trace, opts, []() { Encoder::servicePinA(); }), baseline);
+    report("servicePinB", measure(trace, opts, []() { Encoder::servicePinB(); }), baseline);
+#elif defined(ROTARY_ISR_SERVICE)
+    report("rotaryService", measure(trace, opts, []() { Encoder::rotaryService(); }), baseline);
+#endif
+#ifdef BUTTON_ISR_SERVICE
+    report("serviceButtonEdge", measure(trace, opts, []() { Encoder::serviceButtonEdge(); }), baseline);
+#endif
+
+    // getValue() & getButtonState() depend on the state produced by the service routines,
+    // therefore they are measured together with them and the service cost is subtracted
+    Result serviced = measure(trace, opts, []() {
+        PIN_ISRS();
+        Encoder::service();
+    });
+
+#ifndef ENC_EVENT_QUEUE_SIZE
+    report("getValue", measure(trace, opts, []() {
+               PIN_ISRS();
+               Encoder::service();
+               Encoder::getValue();
+           }),
+           serviced);
+
+    report("getValueBatch", measure(trace, opts, []() {
+               PIN_ISRS();
+               Encoder::service();
+               Encoder::getValueBatch();
+           }),
+           serviced);
+#endif
+
+#ifndef WITHOUT_BUTTON
+    report("getButtonState", measure(trace, opts, []() {
+               PIN_ISRS();
+               Encoder::service();
+               Encoder::getButtonState();
+           }),
+           serviced);
+#endif
+
+#ifdef ENC_EVENT_QUEUE_SIZE
+    report("getEvent", measure(trace, opts, []() {
+               PIN_ISRS();
+               Encoder::service();
+               EncoderEvent event;
+               Encoder::getEvent(event);
+           }),
+           serviced);
+#endif
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,216 @@
+// ----------------------------------------------------------------------------
+// ISR cost benchmark for ClickEncoderSet vs. N separately serviced ClickEncoders
+//
+// N = 1..8 encoders with buttons are wired to the mock ports 0..2 (encoder i
+// uses the pins 3i, 3i+1 & 3i+2). The reference calls N ClickEncoder::service(),
+// which all check their button within the same tick, while the set staggers
+// the button checks. Besides the mean, the 99.9th percentile of the per tick
+// cost is reported, which shows the button check spikes.
+// Both variants must decode the same notches & report the same button events.
+//
+// Options: --rpm <float> --bounce <ticks> --jitter <fraction> --ticks <n> --repeats <n> (see BenchCommon.h)
+// ----------------------------------------------------------------------------
+
+#include <ClickEncoder.h>
+#include <ClickEncoderSet.h>
+
+#include "BenchCommon.h"
+#include "EncoderSim.h"
+
+#include <algorithm>
+#include <vector>
+
+#define MAX_ENCODERS 8
+
+#define BUTTON_INTERVAL 32
+#define BUTTON_HOLD_TIME 1024
+#define BUTTON_DOUBLECLICK_TIME 512
+
+// ---Compile time lists of N encoders--------------------------------------------
+
+// Variant 1 only differs in ENC_ACCEL_TOP, which yields separate static classes reading the same pins,
+// so that both variants can be verified side by side
+template <uint8_t variant>
+struct Members {
+    template <uint8_t i>
+    struct Member {
+        typedef ClickEncoder<3 * i, 3 * i + 1, 3 * i + 2, false, 4, 3072 - variant, 25, 2, BUTTON_INTERVAL, BUTTON_HOLD_TIME, BUTTON_DOUBLECLICK_TIME> type;
+    };
+};
+
+template <uint8_t N, uint8_t variant = 0>
+struct MakeSet {
+    typedef typename MakeList<Members<variant>::template Member, ClickEncoderSet, N>::type type;
+};
+
+// ---Benchmark-------------------------------------------------------------------
+
+// Mean & 99.9th percentile of the per tick cost
+struct TickResult {
+    double ns;
+    double worstNs;
+};
+
+static std::vector<uint32_t> recordTrace(const BenchOptions &opts) {
+    std::vector<EncoderSim> sims;
+    for (uint8_t i = 0; i < MAX_ENCODERS; ++i) {
+        EncoderSimConfig enc;
+        enc.pinA = 3 * i;
+        enc.pinB = 3 * i + 1;
+        enc.rpm = (i & 1 ? -1.0 : 1.0) * opts.rpm * (1.0 + 0.25 * i);
+        enc.bounceTicks = opts.bounce;
+        enc.jitter = opts.jitter;
+        enc.tickMicros = opts.tickMicros;
+        enc.seed = i + 1;
+
+        // Every button is pressed with its own rhythm
+        ButtonSimConfig btn;
+        btn.pin = 3 * i + 2;
+        btn.pressMillis = 100 + 50 * i;
+        btn.periodMillis = 700 + 130 * i;
+        sims.push_back(EncoderSim(enc, btn));
+    }
+
+    std::vector<uint32_t> trace;
+    trace.reserve(opts.ticks);
+    for (uint32_t t = 0; t < opts.ticks; ++t) {
+        for (size_t i = 0; i < sims.size(); ++i) {
+            sims[i].tick();
+        }
+        trace.push_back(mock::ports()[0] | (mock::ports()[1] << 8) | ((uint32_t)mock::ports()[2] << 16));
+    }
+    return trace;
+}
+
+static inline void replay(uint32_t value, const BenchOptions &opts) __attribute__((always_inline));
+static inline void replay(uint32_t value, const BenchOptions &opts) {
+    mock::ports()[0] = (uint8_t)value;
+    mock::ports()[1] = (uint8_t)(value >> 8);
+    mock::ports()[2] = (uint8_t)(value >> 16);
+    mock::advanceMicros(opts.tickMicros);
+}
+
+template <typename Body>
+static TickResult measure(const std::vector<uint32_t> &trace, const BenchOptions &opts, Body body) {
+    TickResult best = {1e300, 1e300};
+    std::vector<double> tickNs(trace.size());
+
+    for (uint32_t r = 0; r < opts.repeats; ++r) {
+        double total = 0.0;
+        for (size_t i = 0; i < trace.size(); ++i) {
+            replay(trace[i], opts);
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            body();
+            std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+            tickNs[i] = std::chrono::duration<double, std::nano>(end - begin).count();
+            total += tickNs[i];
+        }
+
+        // 99.9th percentile instead of the maximum, which is dominated by the OS
+        std::vector<double>::iterator worst = tickNs.begin() + (tickNs.size() * 999) / 1000;
+        std::nth_element(tickNs.begin(), worst, tickNs.end());
+
+        best.ns = std::min(best.ns, total / trace.size());
+        best.worstNs = std::min(best.worstNs, *worst);
+    }
+    return best;
+}
+
+static void report(uint8_t encoders, const char *variant, const TickResult &result, const TickResult &baseline) {
+    double ns = result.ns - baseline.ns;
+    double worstNs = result.worstNs - baseline.worstNs;
+    printf("encoders=%u %-18s %9.2f ns/tick %9.2f ns/tick p99.9\n", encoders, variant, ns < 0.0 ? 0.0 : ns, worstNs < 0.0 ? 0.0 : worstNs);
+}
+
+// Runs both variants side by side and compares the decoded notches & button events of every encoder.
+// The button checks of both variants have a different phase, therefore only the number of events is compared.
+template <uint8_t N>
+static bool verify(const std::vector<uint32_t> &trace, const BenchOptions &opts) {
+    typedef typename MakeSet<N, 1>::type Set;
+    // Accessors for the separately serviced encoders and the members of the set
+    typedef Separate<Members<0>::Member, N> Reference;
+    typedef Separate<Members<1>::Member, N> SetMembers;
+
+    uint32_t buttonEvents[2][N][DoubleClicked + 1] = {};
+
+    replay(trace[0], opts);
+    Reference::init();
+    Set::init();
+
+    auto tick = [&buttonEvents, &opts](uint32_t value) {
+        replay(value, opts);
+        Reference::service();
+        Set::service();
+
+        Reference::consume();
+        SetMembers::consume();
+        for (uint8_t e = 0; e < N; ++e) {
+            ++buttonEvents[0][e][Reference::getButtonState(e)];
+            ++buttonEvents[1][e][SetMembers::getButtonState(e)];
+        }
+    };
+
+    for (size_t t = 0; t < trace.size(); ++t) {
+        tick(trace[t]);
+    }
+
+    // Drain the trace, so that no click is pending at its end, which only one of the variants might report:
+    // a button still pressed is held (a shorter press could be seen as a click by only one variant),
+    // then all buttons (active low) are released and the double click time runs out.
+    for (uint32_t t = 0; t < BUTTON_HOLD_TIME + 2 * BUTTON_INTERVAL; ++t) {
+        tick(trace.back());
+    }
+    uint32_t released = trace.back();
+    for (uint8_t e = 0; e < N; ++e) {
+        released |= (uint32_t)1 << (3 * e + 2);
+    }
+    for (uint32_t t = 0; t < BUTTON_DOUBLECLICK_TIME + 2 * BUTTON_INTERVAL; ++t) {
+        tick(released);
+    }
+
+    bool ok = true;
+    for (uint8_t e = 0; e < N; ++e) {
+        if (Reference::getPosition(e) != SetMembers::getPosition(e)) {
+            printf("encoders=%u MISMATCH encoder %u: position separate %ld set %ld\n", N, e, (long)Reference::getPosition(e), (long)SetMembers::getPosition(e));
+            ok = false;
+        }
+        // Held is reported until the release, the number of ticks depends on the phase of the button checks
+        for (uint8_t state = Released; state <= DoubleClicked; ++state) {
+            if (buttonEvents[0][e][state] != buttonEvents[1][e][state]) {
+                printf("encoders=%u MISMATCH encoder %u: button state %u separate %lu set %lu\n", N, e, state,
+                       (unsigned long)buttonEvents[0][e][state], (unsigned long)buttonEvents[1][e][state]);
+                ok = false;
+            }
+        }
+    }
+    return ok;
+}
+
+template <uint8_t N>
+struct Run {
+    static void run(const std::vector<uint32_t> &trace, const BenchOptions &opts, const TickResult &baseline) {
+        typedef typename MakeSet<N>::type Set;
+
+        Separate<Members<0>::Member, N>::init();
+        report(N, "ClickEncoder x N", measure(trace, opts, []() { Separate<Members<0>::Member, N>::service(); }), baseline);
+        Set::init();
+        report(N, "ClickEncoderSet", measure(trace, opts, []() { Set::service(); }), baseline);
+    }
+};
+
+int main(int argc, char **argv) {
+    BenchOptions opts;
+    parseOptions(argc, argv, opts);
+    // The set counts service() calls & therefore needs 1ms ticks
+    opts.tickMicros = 1000;
+
+    std::vector<uint32_t> trace = recordTrace(opts);
+
+    bool ok = verify<MAX_ENCODERS>(trace, opts);
+    printf("encoders=%u %-18s %s\n", MAX_ENCODERS, "set vs. separate", ok ? "match" : "MISMATCH");
+
+    TickResult baseline = measure(trace, opts, []() {});
+    ForEachCount<Run, MAX_ENCODERS>::run(trace, opts, baseline);
+
+    return ok ? 0 : 1;
+}
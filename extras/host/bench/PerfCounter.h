@@ -0,0 +1,67 @@
+// ----------------------------------------------------------------------------
+// Minimal wrapper around Linux perf_event_open() counting retired user space
+// instructions. Falls back to "not available" if the kernel (or a container
+// sandbox) does not allow access to hardware counters.
+// ----------------------------------------------------------------------------
+
+#ifndef __have__PerfCounter_h__
+#define __have__PerfCounter_h__
+
+#include <stdint.h>
+#include <string.h>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+class PerfCounter {
+  public:
+    PerfCounter() : fd(-1) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    ~PerfCounter() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    bool available() const {
+        return fd >= 0;
+    }
+
+    void start() {
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    uint64_t stop() {
+        uint64_t count = 0;
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd, &count, sizeof(count)) != (ssize_t)sizeof(count)) {
+                count = 0;
+            }
+        }
+        return count;
+    }
+
+  private:
+    PerfCounter(const PerfCounter &);
+    PerfCounter &operator=(const PerfCounter &);
+
+    int fd;
+};
+
+#endif // __have__PerfCounter_h__
@@ -0,0 +1,171 @@
+// ----------------------------------------------------------------------------
+// Host-side stand-in for <Arduino.h>
+//
+// Only provides what ClickEncoder needs to compile and run on a Linux host.
+// Time is fully simulated: the bench / simulator advances it explicitly.
+// ----------------------------------------------------------------------------
+
+#ifndef __have__mock_Arduino_h__
+#define __have__mock_Arduino_h__
+
+#include <stdint.h>
+
+#ifndef _BV
+#define _BV(bit) (1 << (bit))
+#endif
+
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+
+#define LOW 0
+#define HIGH 1
+
+namespace mock {
+
+// Simulated time base in microseconds
+inline volatile unsigned long &microsCounter() {
+    static volatile unsigned long us = 0;
+    return us;
+}
+
+inline void advanceMicros(unsigned long us) {
+    microsCounter() += us;
+}
+
+// Values of the analog pins, analog pins share the numbers of the digital pins
+inline volatile int16_t *analogValues() {
+    static volatile int16_t values[256] = {0};
+    return values;
+}
+
+inline void setAnalog(uint8_t pin, int16_t value) {
+    analogValues()[pin] = value;
+}
+
+} // namespace mock
+
+// ---ADC registers---------------------------------------------------------------
+
+// The single ADC of an AVR, shared by all analog pins: a conversion converts the channel selected by
+// ADMUX (& MUX5 in ADCSRB) when it is started and takes adcConversionMicros() of simulated time.
+// Setting ADSC during a conversion has no effect. Every read of ADCSRA while ADSC is set takes 1us, so
+// busy-waiting for the ADC advances the clock. With the default of 0us a conversion is already complete
+// when setting ADSC returns, and ADSC always reads 0.
+
+static const uint8_t A0 = 0;
+
+#define REFS1 7
+#define REFS0 6
+#define ADSC 6
+#define MUX5 3
+
+// Values of analogReference(), as on the ATmega328P
+#define EXTERNAL 0
+#define DEFAULT 1
+#define INTERNAL 3
+
+namespace mock {
+
+struct AdcRegisters {
+    volatile uint8_t mux;
+    volatile uint8_t controlB;
+    volatile uint16_t result;
+    volatile uint16_t converting;
+    volatile unsigned long conversionEnd;
+};
+
+inline AdcRegisters &adc() {
+    static AdcRegisters regs = {0, 0, 0, 0, 0};
+    return regs;
+}
+
+inline unsigned long &adcConversionMicros() {
+    static unsigned long us = 0;
+    return us;
+}
+
+inline bool adcBusy() {
+    return (long)(microsCounter() - adc().conversionEnd) < 0;
+}
+
+inline uint16_t adcResult() {
+    if (!adcBusy()) {
+        adc().result = adc().converting;
+    }
+    return adc().result;
+}
+
+class AdcControl {
+  public:
+    operator uint8_t() const {
+        if (adcBusy()) {
+            advanceMicros(1);
+            return _BV(ADSC);
+        }
+        return 0;
+    }
+
+    AdcControl &operator|=(uint8_t bits) {
+        if ((bits & _BV(ADSC)) && !adcBusy()) {
+            adc().result = adc().converting;
+            uint8_t channel = (adc().mux & 0x07) | (((adc().controlB >> MUX5) & 0x01) << 3);
+            adc().converting = (uint16_t)analogValues()[channel];
+            adc().conversionEnd = microsCounter() + adcConversionMicros();
+        }
+        return *this;
+    }
+};
+
+inline AdcControl &adcControl() {
+    static AdcControl control;
+    return control;
+}
+
+} // namespace mock
+
+#define ADMUX (mock::adc().mux)
+#define ADCSRB (mock::adc().controlB)
+#define ADCSRA (mock::adcControl())
+#define ADC (mock::adcResult())
+
+namespace mock {
+
+inline uint8_t &analogReferenceMode() {
+    static uint8_t mode = DEFAULT;
+    return mode;
+}
+
+// Like the AVR core: the reference only gets written to ADMUX by the next analogRead()
+inline int16_t analogRead(uint8_t pin) {
+    uint8_t channel = pin >= A0 ? pin - A0 : pin;
+    ADCSRB = (ADCSRB & ~_BV(MUX5)) | (((channel >> 3) & 0x01) << MUX5);
+    ADMUX = (analogReferenceMode() << 6) | (channel & 0x07);
+    ADCSRA |= _BV(ADSC);
+    while (ADCSRA & _BV(ADSC)) {
+    }
+    return ADC;
+}
+
+} // namespace mock
+
+inline void analogReference(uint8_t mode) {
+    mock::analogReferenceMode() = mode;
+}
+
+inline unsigned long micros() {
+    return mock::microsCounter();
+}
+
+inline unsigned long millis() {
+    return mock::microsCounter() / 1000;
+}
+
+// There are no real interrupts on the host, but keep the same compiler barriers
+inline void noInterrupts() {
+    __asm__ __volatile__("" ::: "memory");
+}
+
+inline void interrupts() {
+    __asm__ __volatile__("" ::: "memory");
+}
+
+#endif // __have__mock_Arduino_h__
@@ -0,0 +1,76 @@
+// ----------------------------------------------------------------------------
+// Host-side stand-in for https://github.com/7FM/FastPin
+//
+// Pins are mapped onto volatile 8 bit "port registers": pin p lives in port
+// p / 8 at bit p % 8. This keeps the cost of a digitalRead() close to a real
+// memory mapped IO access and allows reading all pins of a port at once
+// through mock::ports().
+// ----------------------------------------------------------------------------
+
+#ifndef __have__mock_FastPin_h__
+#define __have__mock_FastPin_h__
+
+#include <Arduino.h>
+#include <stdint.h>
+
+namespace mock {
+
+#define MOCK_PORT_COUNT 32
+
+inline volatile uint8_t *ports() {
+    static volatile uint8_t portRegs[MOCK_PORT_COUNT] = {0};
+    return portRegs;
+}
+
+inline volatile uint8_t *pullups() {
+    static volatile uint8_t pullupRegs[MOCK_PORT_COUNT] = {0};
+    return pullupRegs;
+}
+
+inline void setPin(uint8_t pin, bool level) {
+    volatile uint8_t &port = ports()[pin >> 3];
+    if (level) {
+        port |= (1 << (pin & 7));
+    } else {
+        port &= ~(1 << (pin & 7));
+    }
+}
+
+inline bool getPin(uint8_t pin) {
+    return ports()[pin >> 3] & (1 << (pin & 7));
+}
+
+} // namespace mock
+
+// Pin numbers are passed as int, so that ClickEncoder's int8_t button pin (-1 = none) still instantiates
+template <int PIN>
+class FastPin {
+    static_assert(PIN < MOCK_PORT_COUNT * 8, "Pin out of range of the mocked ports!");
+
+    static const uint8_t pin = (uint8_t)PIN;
+    static const uint8_t mask = 1 << (pin & 7);
+
+  public:
+    static inline void setInput() {}
+    static inline void setOutput() {}
+
+    // For inputs hi()/lo() switch the pullup, like on AVR
+    static inline void hi() {
+        mock::pullups()[pin >> 3] |= mask;
+    }
+    static inline void lo() {
+        mock::pullups()[pin >> 3] &= ~mask;
+    }
+
+    static inline bool digitalRead() __attribute__((always_inline)) {
+        return (mock::ports()[pin >> 3] & mask) != 0;
+    }
+
+    static inline int16_t analogRead() {
+        return mock::analogRead(pin);
+    }
+};
+
+#undef MOCK_PORT_COUNT
+
+#endif // __have__mock_FastPin_h__
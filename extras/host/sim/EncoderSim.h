@@ -0,0 +1,147 @@
+// ----------------------------------------------------------------------------
+// Synthetic quadrature waveform & button generator for host builds
+//
+// Drives the mocked FastPin ports with the signal of a rotating encoder
+// (given rpm, contact bounce and speed jitter) and a periodically pressed
+// button. Every call to tick() advances the simulation by one service
+// interval and updates the pins accordingly, the mocked clock is left to the
+// caller so that several simulators can share one port and time base.
+// ----------------------------------------------------------------------------
+
+#ifndef __have__EncoderSim_h__
+#define __have__EncoderSim_h__
+
+#include <FastPin.h>
+
+#include <stdint.h>
+#include <random>
+
+struct EncoderSimConfig {
+    uint8_t pinA = 0;
+    uint8_t pinB = 1;
+    bool pinsActive = false;
+
+    // Rotation: negative rpm turns counter clockwise
+    double rpm = 60.0;
+    uint16_t stepsPerRevolution = 96; // 24 notches with 4 steps each
+
+    // Speed jitter as fraction of the nominal step rate (0.1 = +-10%)
+    double jitter = 0.0;
+
+    // Number of ticks after a contact edge during which the contact may bounce
+    uint8_t bounceTicks = 0;
+    // Probability that a sample within the bounce window reads the wrong level
+    double bounceProbability = 0.5;
+
+    uint32_t tickMicros = 1000;
+    uint32_t seed = 1;
+};
+
+struct ButtonSimConfig {
+    int8_t pin = -1;
+    bool pinsActive = false;
+    // Button is held down for pressMillis every periodMillis (0 = never pressed)
+    uint32_t pressMillis = 0;
+    uint32_t periodMillis = 0;
+};
+
+class EncoderSim {
+  public:
+    explicit EncoderSim(const EncoderSimConfig &cfg, const ButtonSimConfig &btn = ButtonSimConfig())
+        : cfg(cfg), btn(btn), rng(cfg.seed), unit(0.0, 1.0), position(0.0), state(0), steps(0),
+          bounceA(0), bounceB(0), elapsedMicros(0) {
+        writePins(state);
+        writeButton();
+    }
+
+    // Advance the simulation by one service interval
+    void tick() {
+        double stepsPerTick = cfg.rpm / 60.0 * cfg.stepsPerRevolution * cfg.tickMicros / 1e6;
+        if (cfg.jitter > 0.0) {
+            stepsPerTick *= 1.0 + cfg.jitter * (2.0 * unit(rng) - 1.0);
+        }
+        position += stepsPerTick;
+
+        int32_t target = (int32_t)floorSteps(position);
+        uint8_t prevState = state;
+        while (steps < target) {
+            ++steps;
+            state = (state + 1) & 3;
+        }
+        while (steps > target) {
+            --steps;
+            state = (state - 1) & 3;
+        }
+
+        // Restart the bounce window of a line if its ideal level changed
+        if (levelA(state) != levelA(prevState)) {
+            bounceA = cfg.bounceTicks;
+        }
+        if (levelB(state) != levelB(prevState)) {
+            bounceB = cfg.bounceTicks;
+        }
+
+        writePins(state);
+
+        elapsedMicros += cfg.tickMicros;
+        writeButton();
+    }
+
+    // Ideal number of quadrature steps since the start (signed)
+    int32_t expectedSteps() const {
+        return steps;
+    }
+
+  private:
+    static double floorSteps(double v) {
+        int64_t i = (int64_t)v;
+        return (v < 0.0 && (double)i != v) ? (double)(i - 1) : (double)i;
+    }
+
+    // Gray code sequence 00 -> 01 -> 11 -> 10 (A, B) for increasing steps
+    static bool levelA(uint8_t s) {
+        return s >= 2;
+    }
+
+    static bool levelB(uint8_t s) {
+        return s == 1 || s == 2;
+    }
+
+    bool bounce(uint8_t &window, bool ideal) {
+        if (window == 0) {
+            return ideal;
+        }
+        --window;
+        return unit(rng) < cfg.bounceProbability ? !ideal : ideal;
+    }
+
+    void writePins(uint8_t s) {
+        bool a = bounce(bounceA, levelA(s));
+        bool b = bounce(bounceB, levelB(s));
+        mock::setPin(cfg.pinA, a ? cfg.pinsActive : !cfg.pinsActive);
+        mock::setPin(cfg.pinB, b ? cfg.pinsActive : !cfg.pinsActive);
+    }
+
+    void writeButton() {
+        if (btn.pin < 0) {
+            return;
+        }
+        bool pressed = btn.periodMillis && ((elapsedMicros / 1000) % btn.periodMillis) < btn.pressMillis;
+        mock::setPin(btn.pin, pressed ? btn.pinsActive : !btn.pinsActive);
+    }
+
+    EncoderSimConfig cfg;
+    ButtonSimConfig btn;
+
+    std::mt19937 rng;
+    std::uniform_real_distribution<double> unit;
+
+    double position;
+    uint8_t state;
+    int32_t steps;
+    uint8_t bounceA;
+    uint8_t bounceB;
+    uint64_t elapsedMicros;
+};
+
+#endif // __have__EncoderSim_h__